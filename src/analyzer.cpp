@@ -1,70 +1,47 @@
 #include "sched.h"
-#include "x86intrin.h"
 #include <algorithm>
 #include <cassert>
+#include <chrono>
 #include <cmath>
 #include <cstdio>
 #include <limits>
 #include <list>
+#include <map>
+#include <random>
 #include <vector>
 
 #include "analyzer.hpp"
-#include "assembly.hpp"
+#include "inverse.hpp"
 #include "config.hpp"
+#include "solver.hpp"
+#include "statistics.hpp"
 
-// Measurements as described in section 3.2.1 of the Intel "How to Benchmark
-// Code Execution Times" whitepaper:
-// https://www.intel.com/content/dam/www/public/us/en/documents/white-papers/ia-32-ia-64-benchmark-code-execution-paper.pdf
-static uint64_t dare_time(uint8_t* first, uint8_t* second) {
-    auto* f = (volatile uint8_t*)first;
-    auto* s = (volatile uint8_t*)second;
-
-    uint64_t min_cycles = std::numeric_limits<uint64_t>::max();
-
-    for (size_t i = 0; i < DARE_ITERATIONS; i++) {
-        // before measurement: CPUID + RDTSC
-        assembly::cpuid();
-        auto start = assembly::rdtsc();
-        _mm_lfence();
-
-        for (size_t j = 0; j < DARE_ACCESSES_PER_ITER; j++) {
-            _mm_clflush((void*)f);
-            _mm_clflush((void*)s);
-            // clflush is only serialized by mfence, not lfence or sfence
-            _mm_mfence();
-
-            *f;
-            *s;
-        }
-
-        // after measurement: RDTSCP + CPUID
-        auto stop = assembly::rdtscp();
-        assembly::cpuid();
-
-        auto cycles = (stop - start) / DARE_ACCESSES_PER_ITER;
-        if (cycles < min_cycles) {
-            min_cycles = cycles;
-        }
-    }
+analyzer::analyzer(size_t num_superpages, std::optional<size_t> numa_node, std::optional<std::string> const& kernel)
+    : m_source(std::make_unique<hardware_timing_source>(num_superpages, numa_node, kernel)) {
+}
 
-    return min_cycles;
+analyzer::analyzer(std::unique_ptr<timing_source> source)
+    : m_source(std::move(source)) {
 }
 
-analyzer::analyzer(size_t num_superpages) {
-    m_memory.allocate(num_superpages);
+static size_t nearest_power_of_two(double value) {
+    return BIT(std::max(0L, std::lround(std::log2(value))));
 }
 
-void analyzer::find_row_conflict_threshold(size_t num_clusters, std::optional<std::string> const& out_file) {
-    constexpr size_t NUM_SAMPLES = 32 * 1024;
+void analyzer::find_row_conflict_threshold(std::optional<size_t> num_clusters, std::optional<std::string> const& out_file) {
     std::vector<uint64_t> samples;
-    samples.reserve(NUM_SAMPLES);
+    samples.reserve(m_params.threshold_samples);
 
-    LOG("[analyzer] Determining row conflict threshold using %zu samples...\n", NUM_SAMPLES);
+    LOG("[analyzer] Determining row conflict threshold using %zu samples...\n", m_params.threshold_samples);
 
-    for (size_t i = 0; i < NUM_SAMPLES; i++) {
-        auto* first = m_memory.get_random_address();
-        auto* second = m_memory.get_random_address();
-        auto delta = dare_time(first, second);
+    for (size_t i = 0; i < m_params.threshold_samples; i++) {
+        if (i >= TIME_BUDGET_MIN_THRESHOLD_SAMPLES && deadline_passed(m_deadline)) {
+            LOG("[analyzer] Out of time, using only %zu samples.\n", i);
+            break;
+        }
+        auto* first = m_source->get_random_address();
+        auto* second = m_source->get_random_address();
+        auto delta = measure(first, second);
         samples.push_back(delta);
     }
 
@@ -93,10 +70,20 @@ void analyzer::find_row_conflict_threshold(size_t num_clusters, std::optional<st
 
     LOG_VERBOSE("[analyzer] Cycles times are between %zu and %zu.\n", samples.front(), samples.back());
 
-    LOG_VERBOSE("[analyzer] Making sure 1 in %zu (number of clusters) measurements is above threshold...\n", num_clusters);
-    assert(num_clusters > 1);
-    auto num_above_threshold = samples.size() / num_clusters;
-    m_row_conflict_threshold = samples[samples.size() - num_above_threshold];
+    if (num_clusters.has_value()) {
+        LOG_VERBOSE("[analyzer] Making sure 1 in %zu (number of clusters) measurements is above threshold...\n", *num_clusters);
+        assert(*num_clusters > 1);
+        auto num_above_threshold = samples.size() / *num_clusters;
+        m_row_conflict_threshold = samples[samples.size() - num_above_threshold];
+    } else {
+        // Random pairs conflict with a probability of 1 / (number of clusters), so the number of clusters follows from
+        // the fraction of samples above a threshold found in the histogram alone.
+        auto threshold_index = minimum_error_threshold_index(samples);
+        m_row_conflict_threshold = samples[threshold_index - 1];
+        auto fraction_above = (double)(samples.size() - threshold_index) / (double)samples.size();
+        m_estimated_clusters = nearest_power_of_two(1 / fraction_above);
+        LOG("[analyzer] %.2f%% of samples are above the threshold, estimating %zu clusters.\n", 100 * fraction_above, *m_estimated_clusters);
+    }
 
     LOG("[analyzer] Found row conflict threshold to be %zu cycles.\n", m_row_conflict_threshold);
 }
@@ -130,33 +117,112 @@ void analyzer::clean_cluster(std::vector<uint8_t*>& cluster) const {
                 break;
             }
         }
+        // Without time left, the cluster is used as it is.
+        if (removed_addr && deadline_passed(m_deadline)) {
+            LOG("[analyzer] Out of time, stopping to clean the cluster.\n");
+            break;
+        }
     } while (removed_addr);
 
     LOG("[analyzer] Cleaned cluster, removed %zu addresses (out of %zu).\n", initial_size - cluster.size(), initial_size);
 }
 
-void analyzer::build_clusters(size_t num_clusters) {
+void analyzer::find_cluster(std::list<uint8_t*>& address_pool, uint8_t* needle, std::vector<uint8_t*>& cluster) const {
+    LOG_VERBOSE("[analyzer] Testing needle %p against all addresses in pool...\n", needle);
+
+    // Test `needle` against all addresses in the pool.
+    auto it = address_pool.begin();
+    while (it != address_pool.end()) {
+        if (has_row_conflict(needle, *it)) {
+            // These belong to the same cluster.
+            sched_yield();
+            sched_yield();
+            if (has_row_conflict(needle, *it)) {
+                cluster.push_back(*it);
+                address_pool.erase(it++);
+            } else {
+                ++it;
+            }
+        } else {
+            ++it;
+        }
+    }
+}
+
+bool analyzer::build_clusters(std::optional<size_t> num_clusters) {
     assert(m_clusters.empty());
 
-    constexpr size_t NUM_ADDRS_PER_CLUSTER = 64;
-    auto address_pool_size = NUM_ADDRS_PER_CLUSTER * num_clusters;
-    LOG("[analyzer] Building %zu clusters out of address pool with %zu addresses.\n", num_clusters, address_pool_size);
+    // The threshold may have been determined on a subset of the superpages; the clusters should use all of them.
+    m_source->wait_until_ready();
+
+    // Without a given number of clusters, start with the estimate and keep going until the pool is used up.
+    auto expected_clusters = num_clusters.value_or(m_estimated_clusters.value_or(AUTO_CLUSTERS_INITIAL_GUESS));
+    auto address_pool_size = m_params.addrs_per_cluster * expected_clusters;
+    if (num_clusters.has_value()) {
+        LOG("[analyzer] Building %zu clusters out of address pool with %zu addresses.\n", *num_clusters, address_pool_size);
+    } else {
+        LOG("[analyzer] Building clusters (about %zu expected) out of address pool with %zu addresses.\n", expected_clusters, address_pool_size);
+    }
 
     // Build address pool.
     std::list<uint8_t*> address_pool;
     for (size_t i = 0; i < address_pool_size; i++) {
-        address_pool.push_back(m_memory.get_random_address());
+        address_pool.push_back(m_source->get_random_address());
     }
 
     size_t total_addrs_in_clusters = 0;
+    size_t num_extensions = 0;
+    bool stopped_early = false;
     std::vector<std::vector<uint8_t*>> clusters_virt;
+    // Number of addresses each needle found, including the needles whose clusters were too small to keep.
+    std::vector<size_t> needle_cluster_sizes;
+
+    // Adds new addresses to the pool and sorts out those that belong to the existing clusters.
+    auto extend_pool = [&](size_t extension_size) {
+        for (size_t i = 0; i < extension_size; i++) {
+            address_pool.push_back(m_source->get_random_address());
+        }
+        for (auto& cluster : clusters_virt) {
+            if (cluster.empty()) {
+                continue;
+            }
+            auto size_before = cluster.size();
+            find_cluster(address_pool, cluster.front(), cluster);
+            if (cluster.size() != size_before) {
+                total_addrs_in_clusters += cluster.size() - size_before;
+                clean_cluster(cluster);
+            }
+        }
+        address_pool_size += extension_size;
+    };
+
+    while (!num_clusters.has_value() || clusters_virt.size() < *num_clusters) {
+        if (deadline_passed(m_deadline)) {
+            LOG("[analyzer] Out of time, stopping after %zu clusters.\n", clusters_virt.size());
+            m_timed_out = true;
+            break;
+        }
+
+        if (address_pool.empty() && !num_clusters.has_value()) {
+            // There has to be a power of two clusters. If there is not (e.g., because some needles only found too
+            // small clusters), extend the pool with new addresses to find the missing clusters.
+            auto num_built = clusters_virt.size();
+            auto is_power_of_two = num_built >= 2 && (num_built & (num_built - 1)) == 0;
+            if (is_power_of_two || num_extensions == AUTO_CLUSTERS_MAX_EXTENSIONS) {
+                break;
+            }
+            num_extensions++;
+            size_t extension_size = m_params.addrs_per_cluster * BIT(msb_set(std::max<size_t>(num_built, 1)) + 1);
+            LOG("[analyzer] Built %zu clusters, which is not a power of two. Testing %zu more addresses...\n", num_built, extension_size);
+            extend_pool(extension_size);
+            continue;
+        }
 
-    while (clusters_virt.size() < num_clusters) {
         if (address_pool.empty()) {
             LOG_ERROR("[analyzer] No more addresses in pool after building %zu clusters. Cannot continue. "
                       "Is the number of clusters correct?\n",
                 clusters_virt.size());
-            exit(EXIT_FAILURE);
+            return false;
         }
 
         std::vector<uint8_t*> cluster;
@@ -164,27 +230,25 @@ void analyzer::build_clusters(size_t num_clusters) {
         uint8_t* needle = address_pool.back();
         address_pool.pop_back();
 
-        LOG_VERBOSE("[analyzer] Testing needle %p against all addresses in pool...\n", needle);
-
-        // Test `needle` against all addresses in the pool.
-        auto it = address_pool.begin();
-        while (it != address_pool.end()) {
-            if (has_row_conflict(needle, *it)) {
-                // These belong to the same cluster.
-                sched_yield();
-                sched_yield();
-                if (has_row_conflict(needle, *it)) {
-                    cluster.push_back(*it);
-                    address_pool.erase(it++);
-                } else {
-                    ++it;
-                }
-            } else {
-                ++it;
+        find_cluster(address_pool, needle, cluster);
+
+        // Each needle finds about 1 / (number of clusters) of the pool. If the first needles typically find clusters too
+        // small to be kept, the number of clusters was underestimated, and the pool is grown to the number of clusters
+        // their sizes predict. Otherwise, none of the clusters might be kept.
+        needle_cluster_sizes.push_back(cluster.size() + 1);
+        if (!num_clusters.has_value() && needle_cluster_sizes.size() == AUTO_CLUSTERS_SIZE_SAMPLES
+            && median(needle_cluster_sizes) < m_params.addrs_per_cluster / 3) {
+            auto predicted_clusters = nearest_power_of_two((double)address_pool_size / (double)median(needle_cluster_sizes));
+            if (predicted_clusters > expected_clusters) {
+                auto extension_size = m_params.addrs_per_cluster * (predicted_clusters - expected_clusters);
+                LOG("[analyzer] Clusters are smaller than expected, predicting %zu clusters. Testing %zu more addresses...\n",
+                    predicted_clusters, extension_size);
+                expected_clusters = predicted_clusters;
+                extend_pool(extension_size);
             }
         }
 
-        if (cluster.size() < NUM_ADDRS_PER_CLUSTER / 3) {
+        if (cluster.size() < m_params.addrs_per_cluster / 3) {
             LOG("[analyzer] Cluster %zu only has %zu addresses, retrying...\n", clusters_virt.size(), cluster.size());
             continue;
         }
@@ -192,47 +256,151 @@ void analyzer::build_clusters(size_t num_clusters) {
         LOG_VERBOSE("[analyzer] Cluster %zu has %zu addresses (%zu still in pool)\n", clusters_virt.size(), cluster.size(), address_pool.size());
 
         total_addrs_in_clusters += cluster.size();
+        // Clean right away, so that the clusters built so far can already be used by the cluster callback.
+        clean_cluster(cluster);
         clusters_virt.push_back(std::move(cluster));
 
         auto avg_addrs_per_cluster = (double)total_addrs_in_clusters / (double)clusters_virt.size();
         LOG_VERBOSE("    average addresses per cluster: %.1f\n", avg_addrs_per_cluster);
         LOG_VERBOSE("    predicted number of clusters: %ld\n", std::lround(address_pool_size / avg_addrs_per_cluster));
+
+        if (m_cluster_callback && m_cluster_callback(to_phys(clusters_virt))) {
+            LOG("[analyzer] Stopping after %zu clusters, as requested by the cluster callback.\n", clusters_virt.size());
+            stopped_early = true;
+            break;
+        }
     }
 
-    LOG("[analyzer] Built %zu clusters. Cleaning clusters...\n", clusters_virt.size());
-    for (auto& cluster : clusters_virt) {
-        clean_cluster(cluster);
+    if (!num_clusters.has_value() && !stopped_early && !m_timed_out) {
+        // If this is not a power of two, settle_clusters() has to settle on one.
+        auto num_built = clusters_virt.size();
+        if (num_built < 2) {
+            LOG_ERROR("[analyzer] Only found %zu clusters. Cannot continue.\n", num_built);
+            return false;
+        }
+        m_estimated_clusters = num_built;
+    }
+
+    LOG("[analyzer] Built %zu clusters.\n", clusters_virt.size());
+    if (std::any_of(clusters_virt.begin(), clusters_virt.end(), [](auto const& cluster) { return cluster.empty(); })) {
+        LOG_ERROR("[analyzer] At least one cluster is empty after cleaning. Cannot continue.\n");
+        return false;
     }
 
     LOG("[analyzer] Converting clusters to physical addresses.\n");
+    m_clusters = to_phys(clusters_virt);
 
-    // Now, convert to physical addresses.
-    for (auto& cluster_virt : clusters_virt) {
-        m_clusters.emplace_back();
+    LOG("[analyzer] Cluster generation finished.\n");
+    return true;
+}
+
+bool analyzer::settle_clusters(size_t phys_dram_offset, deadline_t deadline, size_t max_bits) {
+    LOG("[analyzer] Settling the number of clusters (%zu built) using the functions constant on all of them...\n", m_clusters.size());
+    solver solver(m_clusters, max_bits);
+    solver.set_deadline(deadline);
+    auto candidates = solver.find_constant_functions(phys_dram_offset);
+    if (!candidates.has_value()) {
+        LOG_ERROR("[analyzer] Out of time while settling the number of clusters.\n");
+        return false;
+    }
+    auto functions = solver.filter_functions(*candidates, phys_dram_offset, feasibility::subset);
+
+    // Clusters of the same bank (e.g., fragments of one bank's cluster) have the same output of all these functions.
+    std::map<size_t, std::vector<uintptr_t>> clusters_by_bank;
+    for (auto const& cluster : m_clusters) {
+        size_t bank = 0;
+        for (size_t i = 0; i < functions.size(); i++) {
+            size_t num_ones = 0;
+            for (auto addr : cluster) {
+                num_ones += func_apply(functions[i], addr - phys_dram_offset);
+            }
+            bank |= size_t(2 * num_ones > cluster.size()) << i;
+        }
+        auto& merged = clusters_by_bank[bank];
+        merged.insert(merged.end(), cluster.begin(), cluster.end());
+    }
+
+    size_t num_banks = BIT(functions.size());
+    if (clusters_by_bank.size() != num_banks) {
+        LOG_ERROR("[analyzer] The %zu clusters only cover %zu of the %zu banks selected by the %zu functions constant on "
+                  "all of them. Cannot settle the number of clusters.\n",
+            m_clusters.size(), clusters_by_bank.size(), num_banks, functions.size());
+        return false;
+    }
+    if (m_clusters.size() != num_banks) {
+        LOG("[analyzer] Merged %zu clusters of the same bank, settling on %zu clusters.\n", m_clusters.size() - num_banks, num_banks);
+    }
+
+    m_clusters.clear();
+    for (auto& [bank, cluster] : clusters_by_bank) {
+        m_clusters.push_back(std::move(cluster));
+    }
+    m_estimated_clusters = num_banks;
+    return true;
+}
+
+std::vector<std::vector<uintptr_t>> analyzer::to_phys(std::vector<std::vector<uint8_t*>> const& clusters_virt) const {
+    std::vector<std::vector<uintptr_t>> clusters_phys;
+    for (auto const& cluster_virt : clusters_virt) {
+        if (cluster_virt.empty()) {
+            continue;
+        }
+        clusters_phys.emplace_back();
+        clusters_phys.back().reserve(cluster_virt.size());
         for (auto* addr_virt : cluster_virt) {
-            auto addr_phys = m_memory.virt_to_phys(addr_virt);
-            m_clusters.back().push_back(addr_phys);
+            clusters_phys.back().push_back(m_source->virt_to_phys(addr_virt));
         }
     }
+    return clusters_phys;
+}
 
-    LOG("[analyzer] Cluster generation finished.\n");
+double analyzer::seconds_per_access(size_t num_pairs) const {
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < num_pairs; i++) {
+        (void)measure(m_source->get_random_address(), m_source->get_random_address());
+    }
+    std::chrono::duration<double> duration = std::chrono::steady_clock::now() - start;
+    return duration.count() / (double)(num_pairs * m_params.iterations * m_params.accesses_per_iter);
+}
+
+uint64_t analyzer::measure(uint8_t* first, uint8_t* second) const {
+    if (!m_perf_monitor) {
+        return m_source->time(first, second, m_params.iterations, m_params.accesses_per_iter);
+    }
+
+    for (size_t i = 0;; i++) {
+        auto before = m_perf_monitor->read();
+        auto cycles = m_source->time(first, second, m_params.iterations, m_params.accesses_per_iter);
+        auto after = m_perf_monitor->read();
+
+        if (!m_perf_monitor->check_window(before, after) || i == DARE_MAX_REMEASUREMENTS) {
+            return cycles;
+        }
+        m_perf_monitor->count_remeasurement();
+    }
 }
 
 bool analyzer::has_row_conflict(uint8_t* first, uint8_t* second) const {
-    return dare_time(first, second) > m_row_conflict_threshold;
+    return measure(first, second) > m_row_conflict_threshold;
+}
+
+void analyzer::print_noise_stats() const {
+    if (m_perf_monitor) {
+        m_perf_monitor->print_stats();
+    }
 }
 
-void analyzer::dump_clusters(const std::string& out_file) {
+bool analyzer::dump_clusters(const std::string& out_file) {
     if (m_clusters.empty()) {
         LOG_ERROR("[analyzer] Error: Cannot dump clusters to file, as there are no clusters.\n");
-        exit(EXIT_FAILURE);
+        return false;
     }
 
     FILE* fp = fopen(out_file.c_str(), "w");
     if (!fp) {
         perror("fopen");
         LOG_ERROR("[analyzer] Error: Could not open out file '%s' for writing.\n", out_file.c_str());
-        exit(EXIT_FAILURE);
+        return false;
     }
 
     for (auto const& cluster : m_clusters) {
@@ -251,4 +419,230 @@ void analyzer::dump_clusters(const std::string& out_file) {
     }
 
     LOG("[analyzer] Wrote %zu clusters to '%s'.\n", m_clusters.size(), out_file.c_str());
+    return true;
+}
+
+std::optional<uintptr_t> analyzer::find_phys_address(std::vector<func_t> const& functions, size_t phys_dram_offset,
+    size_t bank, size_t bank_mask, size_t row_mask, std::optional<uintptr_t> other_row_than) const {
+    // Only the functions selected by bank_mask are constrained.
+    std::vector<func_t> selected_functions;
+    size_t selected_bank = 0;
+    for (size_t i = 0; i < functions.size(); i++) {
+        if (bank_mask & BIT(i)) {
+            selected_bank |= ((bank >> i) & 1) << selected_functions.size();
+            selected_functions.push_back(functions[i]);
+        }
+    }
+
+    // Pick a random superpage (and block within it) and draw one of its addresses in the bank.
+    // If the functions depend on bits that are the same in all superpages, some banks cannot be reached at all.
+    // An address in the row to avoid is drawn again; the row is not constrained directly, as rows usually extend
+    // beyond a superpage.
+    inverse_mapper mapper(std::move(selected_functions), phys_dram_offset, row_mask);
+    for (size_t attempt = 0; attempt < FIND_ADDRESS_MAX_ATTEMPTS; attempt++) {
+        auto phys_hint = m_source->virt_to_phys(m_source->get_random_address());
+        auto phys = mapper.sample(phys_hint & ~SUPERPAGE_MASK, SUPERPAGE, phys_hint, selected_bank, {}, m_generator);
+        if (phys.has_value() && (!other_row_than.has_value() || mapper.row(*phys) != mapper.row(*other_row_than))) {
+            return phys;
+        }
+    }
+
+    LOG_ERROR("[analyzer] Error: Found no address in bank %zu in %zu random superpages.\n", bank, FIND_ADDRESS_MAX_ATTEMPTS);
+    return {};
+}
+
+uint8_t* analyzer::find_address(std::vector<func_t> const& functions, size_t phys_dram_offset, size_t bank,
+    size_t bank_mask, size_t row_mask, std::optional<uintptr_t> other_row_than) const {
+    auto phys = find_phys_address(functions, phys_dram_offset, bank, bank_mask, row_mask, other_row_than);
+    return phys.has_value() ? m_source->phys_to_virt(*phys) : nullptr;
+}
+
+std::vector<uint8_t*> analyzer::find_addresses(std::vector<func_t> const& functions, size_t phys_dram_offset, size_t bank,
+    size_t max_addresses, size_t row_mask, std::optional<size_t> row) const {
+    // Superpages that are still being populated are not returned by phys_superpages() yet.
+    m_source->wait_until_ready();
+
+    std::vector<uint8_t*> addrs;
+    inverse_mapper mapper(functions, phys_dram_offset, row_mask);
+    for (auto phys_base : m_source->phys_superpages()) {
+        auto* virt_base = m_source->phys_to_virt(phys_base);
+        bool more = mapper.enumerate(phys_base, SUPERPAGE, bank, row, [&](uintptr_t phys) {
+            addrs.push_back(virt_base + (phys - phys_base));
+            return addrs.size() < max_addresses;
+        });
+        if (!more) {
+            break;
+        }
+    }
+
+    return addrs;
+}
+
+std::vector<func_label> analyzer::classify_functions(std::vector<func_t> const& functions, size_t phys_dram_offset) const {
+    constexpr size_t CONTENTION_ROUNDS = 16;
+    LOG("[analyzer] Classifying %zu functions...\n", functions.size());
+
+    auto all_functions = BIT(functions.size()) - 1;
+    std::vector<double> latencies;
+    std::vector<double> latency_errors;
+    std::vector<double> speedups;
+
+    // Once the deadline has passed, the functions not measured completely are left unknown.
+    bool timed_out = false;
+    for (size_t i = 0; i < functions.size(); i++) {
+        // 1. Latency of accessing two addresses that only differ in the output of this function. Accesses to
+        // different channels overlap completely, accesses to different bank groups overlap better than accesses
+        // to different banks in the same bank group (tCCD_S vs. tCCD_L), and switching ranks adds a penalty.
+        std::vector<uint64_t> pair_cycles;
+        for (size_t j = 0; j < CLASSIFY_PAIRS_PER_FUNCTION; j++) {
+            if (deadline_passed(m_deadline)) {
+                timed_out = true;
+                break;
+            }
+            auto* first = m_source->get_random_address();
+            auto bank = func_apply_all(functions, m_source->virt_to_phys(first) - phys_dram_offset);
+            auto* second = find_address(functions, phys_dram_offset, bank ^ BIT(i), all_functions);
+            if (!second) {
+                return {};
+            }
+            pair_cycles.push_back(measure(first, second));
+        }
+
+        // 2. Bandwidth contention: accesses that all have the same output of a channel function share half of the
+        // channels, while accesses spread over both outputs can use all of them (see time_concurrent()).
+        std::vector<double> round_speedups;
+        for (size_t round = 0; round < CONTENTION_ROUNDS && !timed_out; round++) {
+            if (deadline_passed(m_deadline)) {
+                timed_out = true;
+                break;
+            }
+            std::vector<uint8_t*> one_side;
+            std::vector<uint8_t*> both_sides;
+            for (size_t j = 0; j < CLASSIFY_CONTENTION_ADDRS; j++) {
+                one_side.push_back(find_address(functions, phys_dram_offset, 0, BIT(i)));
+                both_sides.push_back(find_address(functions, phys_dram_offset, (j & 1) ? BIT(i) : 0, BIT(i)));
+                if (!one_side.back() || !both_sides.back()) {
+                    return {};
+                }
+            }
+            auto one_side_cycles = m_source->time_concurrent(one_side, m_params.iterations);
+            auto both_sides_cycles = m_source->time_concurrent(both_sides, m_params.iterations);
+            round_speedups.push_back((double)one_side_cycles / (double)both_sides_cycles);
+        }
+        if (timed_out) {
+            LOG("[analyzer] Out of time, only classified %zu of %zu functions.\n", i, functions.size());
+            break;
+        }
+        latencies.push_back((double)median(pair_cycles));
+        latency_errors.push_back(median_standard_error(pair_cycles));
+        speedups.push_back(median(round_speedups));
+
+        LOG_VERBOSE("[analyzer] Function 0x%010zx: median pair latency %.1f +- %.1f cycles, contention speedup %.2f\n",
+            functions[i], latencies.back(), latency_errors.back(), speedups.back());
+    }
+
+    std::vector<func_label> labels(functions.size(), func_label::unknown);
+
+    // Sort the remaining functions by latency and split them into levels wherever the gap is significant compared to
+    // the uncertainty of the medians.
+    std::vector<size_t> by_latency;
+    for (size_t i = 0; i < speedups.size(); i++) {
+        if (speedups[i] >= CLASSIFY_CHANNEL_SPEEDUP) {
+            labels[i] = func_label::channel;
+        } else {
+            by_latency.push_back(i);
+        }
+    }
+    std::sort(by_latency.begin(), by_latency.end(), [&](size_t a, size_t b) { return latencies[a] < latencies[b]; });
+
+    std::vector<size_t> level_of(functions.size(), 0);
+    size_t num_levels = by_latency.empty() ? 0 : 1;
+    for (size_t j = 1; j < by_latency.size(); j++) {
+        auto previous = by_latency[j - 1];
+        auto current = by_latency[j];
+        auto error = std::hypot(latency_errors[previous], latency_errors[current]);
+        if (latencies[current] - latencies[previous] > CLASSIFY_LEVEL_GAP_SIGMAS * error) {
+            num_levels++;
+        }
+        level_of[by_latency[j]] = num_levels - 1;
+    }
+
+    // From fastest to slowest: bank group, bank, rank. Without a visible gap, everything is assumed to be a bank.
+    for (auto i : by_latency) {
+        if (num_levels == 1) {
+            labels[i] = func_label::bank;
+        } else if (level_of[i] == 0) {
+            labels[i] = func_label::bank_group;
+        } else if (num_levels >= 3 && level_of[i] == num_levels - 1) {
+            labels[i] = func_label::rank;
+        } else {
+            labels[i] = func_label::bank;
+        }
+    }
+
+    return labels;
+}
+
+std::optional<verification_result> analyzer::verify_functions(std::vector<func_t> const& functions, size_t phys_dram_offset,
+    size_t num_pairs, size_t row_mask) const {
+    LOG("[analyzer] Verifying %zu functions using %zu address pairs each in the same and in different banks...\n",
+        functions.size(), num_pairs);
+
+    auto all_functions = BIT(functions.size()) - 1;
+    std::uniform_int_distribution<size_t> bank_distribution(1, all_functions);
+
+    verification_result result;
+    for (size_t i = 0; i < num_pairs; i++) {
+        // The second address is picked from the entire allocation. Without a row mask, it is in a different row with
+        // overwhelming probability.
+        auto* first = m_source->get_random_address();
+        auto first_phys = m_source->virt_to_phys(first);
+        auto bank = func_apply_all(functions, first_phys - phys_dram_offset);
+
+        std::optional<uintptr_t> other_row_than;
+        if (row_mask != 0) {
+            other_row_than = first_phys;
+        }
+        auto* same_bank = find_address(functions, phys_dram_offset, bank, all_functions, row_mask, other_row_than);
+        auto* other_bank = find_address(functions, phys_dram_offset, bank ^ bank_distribution(m_generator), all_functions);
+        if (!same_bank || !other_bank) {
+            return {};
+        }
+
+        if (has_row_conflict(first, same_bank)) {
+            result.same_bank_conflict++;
+        } else {
+            result.same_bank_no_conflict++;
+        }
+
+        if (has_row_conflict(first, other_bank)) {
+            result.different_bank_conflict++;
+        } else {
+            result.different_bank_no_conflict++;
+        }
+    }
+
+    return result;
+}
+
+bool verification_result::passed() const {
+    auto same_bank = same_bank_conflict + same_bank_no_conflict;
+    auto different_bank = different_bank_conflict + different_bank_no_conflict;
+    return 100.0 * (double)same_bank_conflict >= VERIFY_PASS_PERCENTAGE * (double)same_bank
+        && 100.0 * (double)different_bank_no_conflict >= VERIFY_PASS_PERCENTAGE * (double)different_bank;
 }
+
+void verification_result::print() const {
+    auto same_bank = same_bank_conflict + same_bank_no_conflict;
+    auto different_bank = different_bank_conflict + different_bank_no_conflict;
+
+    printf("                     conflict      no conflict\n");
+    printf("same bank       %8zu (%5.1f%%) %8zu (%5.1f%%)\n", same_bank_conflict,
+        100.0 * (double)same_bank_conflict / (double)same_bank, same_bank_no_conflict,
+        100.0 * (double)same_bank_no_conflict / (double)same_bank);
+    printf("different bank  %8zu (%5.1f%%) %8zu (%5.1f%%)\n", different_bank_conflict,
+        100.0 * (double)different_bank_conflict / (double)different_bank, different_bank_no_conflict,
+        100.0 * (double)different_bank_no_conflict / (double)different_bank);
+    printf("Verification %s (at least %.0f%% of pairs need to behave as predicted).\n",
+        passed() ? "PASSED" : "FAILED", VERIFY_PASS_PERCENTAGE);
+}
\ No newline at end of file
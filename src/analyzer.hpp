@@ -1,33 +1,124 @@
+#include <functional>
+#include <list>
+#include <memory>
 #include <optional>
+#include <random>
 #include <string>
 
+#include "budget.hpp"
+#include "config.hpp"
 #include "function.hpp"
-#include "memory.hpp"
+#include "perf.hpp"
+#include "timing.hpp"
 #include "utils.hpp"
 
 #pragma once
 
+// Result of timing address pairs predicted to be in the same or in different banks.
+struct verification_result {
+    size_t same_bank_conflict { 0 };
+    size_t same_bank_no_conflict { 0 };
+    size_t different_bank_conflict { 0 };
+    size_t different_bank_no_conflict { 0 };
+
+    [[nodiscard]] bool passed() const;
+    void print() const;
+};
+
 class analyzer {
 public:
-    explicit analyzer(size_t num_superpages);
+    // Without a kernel name, the measurement kernel is selected by calibration (see hardware_timing_source).
+    explicit analyzer(size_t num_superpages, std::optional<size_t> numa_node = {}, std::optional<std::string> const& kernel = {});
+    explicit analyzer(std::unique_ptr<timing_source> source);
+
+    void set_params(dare_params const& params) { m_params = params; }
+    [[nodiscard]] dare_params const& params() const { return m_params; }
+
+    // Once the deadline has passed, determining the threshold, building clusters, cleaning them and classifying the
+    // functions stop with what they have so far.
+    void set_deadline(deadline_t deadline) { m_deadline = deadline; }
+    // True if building clusters ran out of time, so only some of the clusters were built.
+    [[nodiscard]] bool timed_out() const { return m_timed_out; }
+    // Wall-clock time of one access (of one iteration of a measurement) with the current parameters.
+    [[nodiscard]] double seconds_per_access(size_t num_pairs) const;
 
-    void find_row_conflict_threshold(size_t num_clusters, std::optional<std::string> const& out_file = {});
+    // Reject and repeat measurements disturbed according to perf_event counters. Has to be called on the thread that
+    // performs the measurements.
+    void enable_noise_detection() { m_perf_monitor = std::make_unique<perf_monitor>(); }
+    void print_noise_stats() const;
+
+    // Without a number of clusters, the threshold is found in the histogram, which also gives an estimate for the
+    // number of clusters.
+    void find_row_conflict_threshold(std::optional<size_t> num_clusters, std::optional<std::string> const& out_file = {});
     void set_row_conflict_threshold(uint64_t threshold) {
         LOG_VERBOSE("[analyzer] Setting row conflict threshold to %zu.\n", threshold);
         m_row_conflict_threshold = threshold;
     }
 
-    void build_clusters(size_t num_clusters);
+    // Called with the cleaned clusters built so far (as physical addresses) whenever a cluster has been added. If it
+    // returns true, no more clusters are built.
+    using cluster_callback = std::function<bool(std::vector<std::vector<uintptr_t>> const&)>;
+    void set_cluster_callback(cluster_callback callback) { m_cluster_callback = std::move(callback); }
+
+    // Returns false if not enough clusters could be built. Without a number of clusters, clusters are built until the
+    // address pool is used up (growing it if the clusters are smaller than expected, or their number is not a power of
+    // two).
+    [[nodiscard]] bool build_clusters(std::optional<size_t> num_clusters);
+    // Merges the clusters that the functions constant on all of them cannot tell apart (e.g., fragments of one bank's
+    // cluster), so that there is one cluster per bank these functions select, i.e., a power of two that agrees with
+    // the rank of the functions. Returns false (and keeps the clusters) if some banks have no cluster, or if the search
+    // for the functions did not finish before the deadline.
+    [[nodiscard]] bool settle_clusters(size_t phys_dram_offset, deadline_t deadline = {}, size_t max_bits = BRUTE_FORCE_MAX_BITS);
+    [[nodiscard]] std::optional<size_t> estimated_num_clusters() const { return m_estimated_clusters; }
 
     [[nodiscard]] std::vector<std::vector<uintptr_t>> const& clusters() const { return m_clusters; }
 
-    void dump_clusters(std::string const& out_file);
+    // Returns false if the clusters could not be written.
+    [[nodiscard]] bool dump_clusters(std::string const& out_file);
+
+    // Determines which part of the DRAM hierarchy (channel, rank, bank group, bank) each of the functions selects.
+    // Returns nothing if the functions do not map any of the allocated memory to some bank. Functions that were not
+    // measured before the deadline are labeled unknown.
+    [[nodiscard]] std::vector<func_label> classify_functions(std::vector<func_t> const& functions, size_t phys_dram_offset) const;
+
+    // Checks a known mapping by timing address pairs that are predicted to conflict (same bank, different row) or not
+    // (different bank). With a row mask, the same-bank pairs are guaranteed to be in different rows; otherwise, they
+    // are in different rows with overwhelming probability. Returns nothing if the functions do not map any of the
+    // allocated memory to some bank.
+    [[nodiscard]] std::optional<verification_result> verify_functions(std::vector<func_t> const& functions, size_t phys_dram_offset,
+        size_t num_pairs, size_t row_mask = 0) const;
+
+    // Returns (up to max_addresses) virtual addresses that map to the bank and, if given, the row made up of the bits
+    // in row_mask. The addresses are computed directly from the functions, without any measurements, and are only valid
+    // as long as the analyzer (which owns the memory) exists.
+    [[nodiscard]] std::vector<uint8_t*> find_addresses(std::vector<func_t> const& functions, size_t phys_dram_offset,
+        size_t bank, size_t max_addresses, size_t row_mask = 0, std::optional<size_t> row = {}) const;
 
 private:
+    [[nodiscard]] uint64_t measure(uint8_t* first, uint8_t* second) const;
     [[nodiscard]] bool has_row_conflict(uint8_t* first, uint8_t* second) const;
     void clean_cluster(std::vector<uint8_t*>& cluster) const;
+    // Skips empty clusters.
+    [[nodiscard]] std::vector<std::vector<uintptr_t>> to_phys(std::vector<std::vector<uint8_t*>> const& clusters_virt) const;
+    // Moves all addresses in the pool that conflict with the needle to the cluster.
+    void find_cluster(std::list<uint8_t*>& address_pool, uint8_t* needle, std::vector<uint8_t*>& cluster) const;
+    // Returns a random address for which the functions selected by bank_mask have the same output as in bank, or
+    // nothing if there was none in FIND_ADDRESS_MAX_ATTEMPTS random superpages. If other_row_than is given, the
+    // address is in a different row (made up of the bits in row_mask) than that address.
+    [[nodiscard]] std::optional<uintptr_t> find_phys_address(std::vector<func_t> const& functions, size_t phys_dram_offset,
+        size_t bank, size_t bank_mask, size_t row_mask = 0, std::optional<uintptr_t> other_row_than = {}) const;
+    // Same as find_phys_address(), but returns a virtual address, or nullptr if there was none.
+    [[nodiscard]] uint8_t* find_address(std::vector<func_t> const& functions, size_t phys_dram_offset, size_t bank,
+        size_t bank_mask, size_t row_mask = 0, std::optional<uintptr_t> other_row_than = {}) const;
 
-    memory m_memory;
+    std::unique_ptr<timing_source> m_source;
+    dare_params m_params;
+    mutable std::default_random_engine m_generator { std::random_device {}() };
+    std::unique_ptr<perf_monitor> m_perf_monitor;
+    cluster_callback m_cluster_callback;
+    deadline_t m_deadline;
+    bool m_timed_out { false };
     uint64_t m_row_conflict_threshold { 0 };
+    std::optional<size_t> m_estimated_clusters;
     std::vector<std::vector<uintptr_t>> m_clusters;
 };
@@ -33,4 +33,21 @@ inline uint64_t rdtscp() {
     return (uint64_t(cycles_high) << 32) | cycles_low;
 }
 
+// Reads the APERF register (actual core cycles) using RDPRU (AMD Zen 2 and later). Spelled out as bytes, as not all
+// assemblers know the instruction.
+inline uint64_t rdpru_aperf() {
+    uint32_t cycles_high, cycles_low;
+    asm volatile(
+        ".byte 0x0f, 0x01, 0xfd\n\t"
+        : "=d"(cycles_high), "=a"(cycles_low)
+        : "c"(1));
+    return (uint64_t(cycles_high) << 32) | cycles_low;
+}
+
+inline void clflushopt(volatile void* addr) {
+    asm volatile(
+        "clflushopt %0\n\t"
+        : "+m"(*(volatile uint8_t*)addr));
+}
+
 }
@@ -0,0 +1,387 @@
+#include <argagg.hpp>
+#include <chrono>
+#include <iostream>
+#include <optional>
+
+#include "analyzer.hpp"
+#include "pipeline.hpp"
+#include "solver.hpp"
+#include "synthetic.hpp"
+#include "translator.hpp"
+#include "utils.hpp"
+
+// Sweeps the measurement budget (see dare_params) over a simulated DRAM and reports which settings still recover the
+// correct functions, and at which cost.
+
+// Used if no functions are given. Resembles a single-channel, single-rank DDR4 system with 32 banks.
+static std::vector<func_t> const DEFAULT_FUNCTIONS {
+    BIT(8) | BIT(14),
+    BIT(9) | BIT(15),
+    BIT(12) | BIT(16),
+    BIT(13) | BIT(17),
+    BIT(18) | BIT(22),
+};
+
+struct {
+    std::vector<func_t> functions { DEFAULT_FUNCTIONS };
+    size_t num_superpages { 12 };
+    size_t repeats { 3 };
+    uint64_t seed { 1 };
+    double ghz { 3.0 };
+    std::vector<size_t> threshold_samples { 2048, 8192, DARE_THRESHOLD_SAMPLES };
+    std::vector<size_t> addrs_per_cluster { 16, 32, DARE_ADDRS_PER_CLUSTER };
+    std::vector<size_t> iterations { 2, 4, DARE_ITERATIONS };
+    std::vector<size_t> accesses_per_iter { 4, 8, DARE_ACCESSES_PER_ITER };
+    std::optional<std::string> out_file;
+    std::optional<size_t> max_outlier_clusters;
+    size_t num_channel_functions { 0 };
+    size_t max_bits { BRUTE_FORCE_MAX_BITS };
+    bool auto_clusters { false };
+    bool pipeline { false };
+    bool translator { false };
+} args;
+
+struct result {
+    dare_params params;
+    size_t num_correct { 0 };
+    double avg_measurements { 0 };
+    double avg_simulated_seconds { 0 };
+    double avg_wall_seconds { 0 };
+
+    [[nodiscard]] double success_rate() const { return (double)num_correct / (double)args.repeats; }
+};
+
+static std::vector<size_t> parse_list(std::string const& str) {
+    std::vector<size_t> values;
+    size_t start = 0;
+    while (start <= str.size()) {
+        auto end = str.find(',', start);
+        if (end == std::string::npos) {
+            end = str.size();
+        }
+        values.push_back(std::stoul(str.substr(start, end - start)));
+        start = end + 1;
+    }
+    return values;
+}
+
+void parse_args(int argc, char** argv) {
+    argagg::parser parser { { { "help", { "-h", "--help" }, "show help", 0 },
+        { "functions", { "--functions" }, "file with the simulated bank functions (default: built-in DDR4 mapping)", 1 },
+        { "superpages", { "--superpages" }, "number of simulated superpages (default: 12)", 1 },
+        { "repeats", { "--repeats" }, "runs per configuration, with different seeds (default: 3)", 1 },
+        { "seed", { "--seed" }, "seed of the first run (default: 1)", 1 },
+        { "ghz", { "--ghz" }, "simulated TSC frequency, used to convert cycles to time (default: 3.0)", 1 },
+        { "threshold_samples", { "--threshold-samples" }, "comma-separated list of threshold sample counts", 1 },
+        { "addrs_per_cluster", { "--addrs-per-cluster" }, "comma-separated list of addresses per cluster", 1 },
+        { "iterations", { "--iterations" }, "comma-separated list of iterations per measurement", 1 },
+        { "accesses", { "--accesses" }, "comma-separated list of accesses per iteration", 1 },
+        { "max_bits", { "--max-bits" }, "maximum number of bits per function the solver tries (default: 10)", 1 },
+        { "max_outliers", { "--max-outliers" }, "solve using likelihood scoring with this many outlier clusters (default: strict)", 1 },
+        { "channels", { "--channels" }, "the first this many functions select the channel; runs only count as correct if the channel functions are also classified correctly", 1 },
+        { "auto_clusters", { "--auto-clusters" }, "let the analyzer estimate the number of clusters", 0 },
+        { "pipeline", { "--pipeline" }, "solve while building clusters and stop once the functions are stable", 0 },
+        { "translator", { "--translator" }, "instead of sweeping, check the translator kernels against the scalar translation and time them", 0 },
+        { "out", { "--out" }, "file to save all results to (in CSV format)", 1 } } };
+
+    argagg::parser_results parsed_args;
+    try {
+        parsed_args = parser.parse(argc, argv);
+    } catch (std::exception const& e) {
+        std::cerr << e.what() << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    if (parsed_args["help"]) {
+        std::cerr << parser << std::endl;
+        exit(EXIT_SUCCESS);
+    }
+
+    if (parsed_args.has_option("functions")) {
+        args.functions = func_read_file(parsed_args["functions"].as<std::string>().c_str());
+        if (args.functions.empty() || !func_are_linearly_independent(args.functions)) {
+            LOG_ERROR("Error: The functions must be non-empty and linearly independent.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (parsed_args.has_option("superpages")) {
+        args.num_superpages = parsed_args["superpages"].as<size_t>();
+    }
+    if (parsed_args.has_option("repeats")) {
+        args.repeats = parsed_args["repeats"].as<size_t>();
+    }
+    if (parsed_args.has_option("seed")) {
+        args.seed = parsed_args["seed"].as<uint64_t>();
+    }
+    if (parsed_args.has_option("ghz")) {
+        args.ghz = parsed_args["ghz"].as<double>();
+    }
+    if (parsed_args.has_option("threshold_samples")) {
+        args.threshold_samples = parse_list(parsed_args["threshold_samples"].as<std::string>());
+    }
+    if (parsed_args.has_option("addrs_per_cluster")) {
+        args.addrs_per_cluster = parse_list(parsed_args["addrs_per_cluster"].as<std::string>());
+    }
+    if (parsed_args.has_option("iterations")) {
+        args.iterations = parse_list(parsed_args["iterations"].as<std::string>());
+    }
+    if (parsed_args.has_option("accesses")) {
+        args.accesses_per_iter = parse_list(parsed_args["accesses"].as<std::string>());
+    }
+    if (parsed_args.has_option("max_bits")) {
+        args.max_bits = parsed_args["max_bits"].as<size_t>();
+    }
+    if (parsed_args.has_option("max_outliers")) {
+        args.max_outlier_clusters.emplace(parsed_args["max_outliers"].as<size_t>());
+    }
+    if (parsed_args.has_option("channels")) {
+        args.num_channel_functions = parsed_args["channels"].as<size_t>();
+        if (args.num_channel_functions > args.functions.size()) {
+            LOG_ERROR("Error: There are only %zu functions.\n", args.functions.size());
+            exit(EXIT_FAILURE);
+        }
+    }
+    args.auto_clusters = parsed_args.has_option("auto_clusters");
+    args.pipeline = parsed_args.has_option("pipeline");
+    args.translator = parsed_args.has_option("translator");
+    if (parsed_args.has_option("out")) {
+        args.out_file.emplace(parsed_args["out"].as<std::string>());
+    }
+}
+
+// A function found is a channel function if it only depends on the simulated channel functions.
+static bool classified_correctly(std::vector<func_t> const& functions, std::vector<func_label> const& labels) {
+    if (labels.size() != functions.size()) {
+        return false;
+    }
+    std::vector<func_t> channel_functions(args.functions.begin(), args.functions.begin() + (ssize_t)args.num_channel_functions);
+    for (size_t i = 0; i < functions.size(); i++) {
+        auto combined = channel_functions;
+        combined.push_back(functions[i]);
+        bool is_channel = !func_are_linearly_independent(combined);
+        if (is_channel != (labels[i] == func_label::channel)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static result run_configuration(dare_params const& params) {
+    std::optional<size_t> num_clusters;
+    if (!args.auto_clusters) {
+        num_clusters.emplace(BIT(args.functions.size()));
+    }
+    result res;
+    res.params = params;
+
+    for (size_t repeat = 0; repeat < args.repeats; repeat++) {
+        synthetic_timing_params synthetic_params;
+        synthetic_params.seed = args.seed + repeat;
+        synthetic_params.num_superpages = args.num_superpages;
+        synthetic_params.num_channel_functions = args.num_channel_functions;
+        auto source = std::make_unique<synthetic_timing_source>(args.functions, synthetic_params);
+        auto const& stats = *source;
+
+        auto start = std::chrono::steady_clock::now();
+
+        analyzer analyzer(std::move(source));
+        analyzer.set_params(params);
+        analyzer.find_row_conflict_threshold(num_clusters);
+
+        std::optional<pipelined_solver> pipeline;
+        bool stopped_early = false;
+        auto expected_num_clusters = num_clusters.has_value() ? num_clusters : analyzer.estimated_num_clusters();
+        if (args.pipeline && !args.max_outlier_clusters.has_value() && expected_num_clusters.has_value()) {
+            pipeline.emplace(0, *expected_num_clusters, args.max_bits);
+            analyzer.set_cluster_callback([&](auto const& clusters) {
+                stopped_early = pipeline->submit(clusters);
+                return stopped_early;
+            });
+        }
+
+        auto built = analyzer.build_clusters(num_clusters);
+        if (!stopped_early) {
+            pipeline.reset();
+        }
+        // As in dare, without a number of clusters, clusters of the same bank are merged if the number of clusters is
+        // not a power of two or does not agree with the number of functions found.
+        auto settle_clusters = built && !num_clusters.has_value() && !stopped_early;
+        auto num_built = analyzer.clusters().size();
+        if (settle_clusters && (num_built & (num_built - 1)) != 0) {
+            built = analyzer.settle_clusters(0, {}, args.max_bits);
+        }
+        if (built) {
+            solver solver(analyzer.clusters(), args.max_bits);
+            std::vector<func_t> functions;
+            if (stopped_early) {
+                functions = *pipeline->result();
+            } else if (args.max_outlier_clusters.has_value()) {
+                for (auto const& scored : solver.find_bank_functions_scored(0, *args.max_outlier_clusters)) {
+                    functions.push_back(scored.func);
+                }
+            } else {
+                functions = solver.find_bank_functions(0);
+                auto disagrees = BIT(functions.size()) != analyzer.clusters().size() && solver.search_completed();
+                if (settle_clusters && disagrees && analyzer.settle_clusters(0, {}, args.max_bits)) {
+                    solver.set_clusters(analyzer.clusters());
+                    functions = solver.find_bank_functions(0);
+                }
+            }
+            bool correct = func_spans_equal(functions, args.functions);
+            if (correct && args.num_channel_functions > 0) {
+                correct = classified_correctly(functions, analyzer.classify_functions(functions, 0));
+            }
+            res.num_correct += correct;
+        }
+
+        std::chrono::duration<double> wall_time = std::chrono::steady_clock::now() - start;
+        res.avg_measurements += (double)stats.num_measurements() / (double)args.repeats;
+        res.avg_simulated_seconds += stats.simulated_cycles() / (args.ghz * 1e9) / (double)args.repeats;
+        res.avg_wall_seconds += wall_time.count() / (double)args.repeats;
+    }
+
+    return res;
+}
+
+static void print_result(FILE* fp, result const& res) {
+    fprintf(fp, "%zu,%zu,%zu,%zu,%.2f,%.0f,%.3f,%.3f\n", res.params.threshold_samples, res.params.addrs_per_cluster,
+        res.params.iterations, res.params.accesses_per_iter, res.success_rate(), res.avg_measurements,
+        res.avg_simulated_seconds, res.avg_wall_seconds);
+}
+
+static constexpr char const* CSV_HEADER = "threshold_samples,addrs_per_cluster,iterations,accesses_per_iter,"
+                                          "success_rate,measurements,simulated_seconds,wall_seconds\n";
+
+// Translates random addresses with every kernel of mapping_translator the CPU supports, checks the results against the
+// scalar translation, and reports the time per address.
+static int bench_translator() {
+    constexpr size_t NUM_ADDRESSES = 1 << 20;
+    constexpr size_t ROUNDS = 16;
+
+    mapping_descriptor descriptor;
+    descriptor.functions.assign(args.functions.begin(), args.functions.end());
+    descriptor.row_mask = 0x3fffc0000;
+    descriptor.column_mask = 0x1fff;
+
+    std::mt19937_64 generator(args.seed);
+    std::vector<uint64_t> phys(NUM_ADDRESSES);
+    for (auto& addr : phys) {
+        addr = generator() & (BIT(40) - 1);
+    }
+
+    mapping_translator translator(descriptor);
+    std::vector<uint64_t> expected_banks(NUM_ADDRESSES);
+    std::vector<uint64_t> expected_rows(NUM_ADDRESSES);
+    std::vector<uint64_t> expected_columns(NUM_ADDRESSES);
+    for (size_t i = 0; i < NUM_ADDRESSES; i++) {
+        expected_banks[i] = translator.bank(phys[i]);
+        expected_rows[i] = translator.row(phys[i]);
+        expected_columns[i] = translator.column(phys[i]);
+    }
+
+    bool all_correct = true;
+    for (auto kernel : mapping_translator::ALL_KERNELS) {
+        if (!translator.use_kernel(kernel)) {
+            printf("%-18s not supported\n", mapping_translator::kernel_name(kernel));
+            continue;
+        }
+
+        std::vector<uint64_t> banks(NUM_ADDRESSES);
+        std::vector<uint64_t> rows(NUM_ADDRESSES);
+        std::vector<uint64_t> columns(NUM_ADDRESSES);
+        auto start = std::chrono::steady_clock::now();
+        for (size_t round = 0; round < ROUNDS; round++) {
+            translator.translate(phys.data(), NUM_ADDRESSES, banks.data(), nullptr, nullptr);
+        }
+        std::chrono::duration<double> bank_time = std::chrono::steady_clock::now() - start;
+        start = std::chrono::steady_clock::now();
+        for (size_t round = 0; round < ROUNDS; round++) {
+            translator.translate(phys.data(), NUM_ADDRESSES, banks.data(), rows.data(), columns.data());
+        }
+        std::chrono::duration<double> all_time = std::chrono::steady_clock::now() - start;
+
+        bool correct = banks == expected_banks && rows == expected_rows && columns == expected_columns;
+        all_correct &= correct;
+        auto num_translated = (double)(ROUNDS * NUM_ADDRESSES);
+        printf("%-18s %6.2f ns/address (bank only), %6.2f ns/address (bank, row, column), %s\n",
+            mapping_translator::kernel_name(kernel), 1e9 * bank_time.count() / num_translated,
+            1e9 * all_time.count() / num_translated, correct ? "matches scalar" : "MISMATCH");
+    }
+    return all_correct ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+int main(int argc, char** argv) {
+    parse_args(argc, argv);
+    if (args.translator) {
+        return bench_translator();
+    }
+
+    std::vector<result> results;
+    auto num_configurations = args.threshold_samples.size() * args.addrs_per_cluster.size() * args.iterations.size() * args.accesses_per_iter.size();
+    LOG("[bench] Sweeping %zu configurations with %zu runs each (%zu functions, %zu superpages).\n",
+        num_configurations, args.repeats, args.functions.size(), args.num_superpages);
+
+    for (auto threshold_samples : args.threshold_samples) {
+        for (auto addrs_per_cluster : args.addrs_per_cluster) {
+            for (auto iterations : args.iterations) {
+                for (auto accesses_per_iter : args.accesses_per_iter) {
+                    dare_params params { threshold_samples, addrs_per_cluster, iterations, accesses_per_iter };
+
+                    log_quiet = true;
+                    results.push_back(run_configuration(params));
+                    log_quiet = false;
+
+                    auto const& res = results.back();
+                    LOG("[bench] %zu/%zu: samples=%zu addrs=%zu iterations=%zu accesses=%zu -> %.0f%% correct, "
+                        "%.0f measurements, %.2f s simulated\n",
+                        results.size(), num_configurations, threshold_samples, addrs_per_cluster, iterations,
+                        accesses_per_iter, 100 * res.success_rate(), res.avg_measurements, res.avg_simulated_seconds);
+                }
+            }
+        }
+    }
+
+    if (args.out_file.has_value()) {
+        FILE* fp = fopen(args.out_file->c_str(), "w");
+        if (!fp) {
+            perror("fopen");
+            LOG_ERROR("[bench] Error: Could not open out file '%s' for writing.\n", args.out_file->c_str());
+            exit(EXIT_FAILURE);
+        }
+        fputs(CSV_HEADER, fp);
+        for (auto const& res : results) {
+            print_result(fp, res);
+        }
+        if (fclose(fp) != 0) {
+            perror("close");
+            LOG_ERROR("[bench] Error: Could not close out file '%s'.\n", args.out_file->c_str());
+        }
+        LOG("[bench] Wrote %zu results to '%s'.\n", results.size(), args.out_file->c_str());
+    }
+
+    // Pareto frontier over (simulated time, success rate): walking from the cheapest configuration upwards, keep
+    // every configuration that is more reliable than all cheaper ones. Configurations that never succeeded are useless.
+    std::sort(results.begin(), results.end(), [](result const& a, result const& b) {
+        return a.avg_simulated_seconds < b.avg_simulated_seconds;
+    });
+
+    printf("Pareto frontier (cheapest first):\n");
+    fputs(CSV_HEADER, stdout);
+    double best_success_rate = 0;
+    for (auto const& res : results) {
+        if (res.success_rate() > best_success_rate) {
+            best_success_rate = res.success_rate();
+            print_result(stdout, res);
+        }
+    }
+
+    auto cheapest_reliable = std::find_if(results.begin(), results.end(), [](result const& res) { return res.num_correct == args.repeats; });
+    if (cheapest_reliable != results.end()) {
+        printf("Cheapest reliable configuration: ");
+        print_result(stdout, *cheapest_reliable);
+    } else {
+        printf("No configuration recovered the correct functions in all runs.\n");
+    }
+
+    return 0;
+}
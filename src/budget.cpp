@@ -0,0 +1,70 @@
+#include <numeric>
+
+#include "budget.hpp"
+#include "utils.hpp"
+
+// Parameters are halved in this order, down to the given minimum, until the run fits into the budget. The minimums
+// are the cheapest settings that still recovered the functions reliably in dare_bench.
+struct scaling_step {
+    size_t dare_params::*param;
+    size_t minimum;
+};
+
+static constexpr std::array<scaling_step, 5> SCALING_STEPS { {
+    { &dare_params::iterations, 4 },
+    { &dare_params::accesses_per_iter, 8 },
+    { &dare_params::addrs_per_cluster, 32 },
+    { &dare_params::threshold_samples, 8192 },
+    { &dare_params::addrs_per_cluster, 16 },
+} };
+
+// Number of measurements for determining the threshold and building and cleaning the clusters: every needle is tested
+// against the rest of the pool, and every address in a cluster against all others in it.
+static double predicted_measurements(dare_params const& params, size_t num_clusters) {
+    auto addrs = (double)params.addrs_per_cluster;
+    auto clusters = (double)num_clusters;
+    return (double)params.threshold_samples + addrs * clusters * (clusters + 1) / 2 + addrs * addrs * clusters;
+}
+
+time_budget::time_budget(std::chrono::steady_clock::time_point start, double seconds)
+    : m_end(start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(seconds))) {
+}
+
+std::chrono::steady_clock::time_point time_budget::start_phase(phase phase) const {
+    auto now = std::chrono::steady_clock::now();
+    if (now >= m_end) {
+        return m_end;
+    }
+    auto later_shares = std::accumulate(SHARES.begin() + phase, SHARES.end(), 0.0);
+    auto phase_time = (m_end - now) * (SHARES[phase] / later_shares);
+    return now + std::chrono::duration_cast<std::chrono::steady_clock::duration>(phase_time);
+}
+
+double time_budget::remaining_seconds() const {
+    return std::chrono::duration<double>(m_end - std::chrono::steady_clock::now()).count();
+}
+
+dare_params time_budget::scale_params(dare_params params, double seconds_per_access, size_t expected_num_clusters) const {
+    auto available = remaining_seconds() * (SHARES[THRESHOLD] + SHARES[CLUSTERS]) / std::accumulate(SHARES.begin(), SHARES.end(), 0.0);
+    auto predicted_seconds = [&] {
+        auto accesses = (double)(params.iterations * params.accesses_per_iter);
+        return predicted_measurements(params, expected_num_clusters) * accesses * seconds_per_access;
+    };
+
+    LOG_VERBOSE("[budget] Default parameters need about %.1f s, %.1f s are available.\n", predicted_seconds(), available);
+    for (auto const& step : SCALING_STEPS) {
+        while (predicted_seconds() > available && params.*step.param / 2 >= step.minimum) {
+            params.*step.param /= 2;
+        }
+    }
+
+    auto predicted = predicted_seconds();
+    LOG("[budget] Using %zu threshold samples, %zu addresses per cluster, %zu iterations and %zu accesses per "
+        "iteration (about %.1f s for %.1f s available).\n",
+        params.threshold_samples, params.addrs_per_cluster, params.iterations, params.accesses_per_iter, predicted, available);
+    if (predicted > available) {
+        LOG_ERROR("[budget] Warning: Even the cheapest parameters are predicted not to fit into the time budget. The "
+                  "result will likely be partial.\n");
+    }
+    return params;
+}
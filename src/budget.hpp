@@ -0,0 +1,45 @@
+#include <array>
+#include <chrono>
+#include <cstdlib>
+#include <optional>
+
+#include "config.hpp"
+
+#pragma once
+
+using deadline_t = std::optional<std::chrono::steady_clock::time_point>;
+
+// Returns true if there is a deadline and it has passed.
+inline bool deadline_passed(deadline_t const& deadline) {
+    return deadline.has_value() && std::chrono::steady_clock::now() >= *deadline;
+}
+
+// Splits a wall-clock budget over the phases of a run. When a phase starts, it gets its share of the time left,
+// relative to the shares of the phases after it, so time a phase does not use goes to the later ones.
+class time_budget {
+public:
+    enum phase : size_t {
+        THRESHOLD,
+        CLUSTERS,
+        SOLVE,
+        CLASSIFY,
+        NUM_PHASES
+    };
+
+    time_budget(std::chrono::steady_clock::time_point start, double seconds);
+
+    // Returns the deadline of the phase, which starts now.
+    [[nodiscard]] std::chrono::steady_clock::time_point start_phase(phase phase) const;
+    [[nodiscard]] double remaining_seconds() const;
+    [[nodiscard]] bool expired() const { return remaining_seconds() <= 0; }
+
+    // Scales the measurement parameters down until the threshold and cluster phases are predicted to fit into their
+    // share of the time left, given how long a single access (of one iteration of a measurement) takes.
+    [[nodiscard]] dare_params scale_params(dare_params params, double seconds_per_access, size_t expected_num_clusters) const;
+
+private:
+    static constexpr std::array<double, NUM_PHASES> SHARES { TIME_BUDGET_SHARE_THRESHOLD, TIME_BUDGET_SHARE_CLUSTERS,
+        TIME_BUDGET_SHARE_SOLVE, TIME_BUDGET_SHARE_CLASSIFY };
+
+    std::chrono::steady_clock::time_point m_end;
+};
@@ -5,6 +5,24 @@
 // Parameters for the dare_time function.
 constexpr size_t DARE_ITERATIONS = 16;
 constexpr size_t DARE_ACCESSES_PER_ITER = 32;
+// Number of random address pairs timed with every measurement kernel to select the best one.
+constexpr size_t TIMING_CALIBRATION_PAIRS = 1024;
+// Number of random address pairs timed to determine the row conflict threshold.
+constexpr size_t DARE_THRESHOLD_SAMPLES = 32 * 1024;
+// Size of the address pool used to build clusters, per expected cluster.
+constexpr size_t DARE_ADDRS_PER_CLUSTER = 64;
+// If the number of clusters is not given: initial guess if the threshold is not determined either, and how often the
+// address pool is extended to reach a power of two clusters.
+constexpr size_t AUTO_CLUSTERS_INITIAL_GUESS = 16;
+constexpr size_t AUTO_CLUSTERS_MAX_EXTENSIONS = 3;
+// Number of needles whose cluster sizes are used to check the estimated number of clusters (and to grow the address
+// pool if it was underestimated).
+constexpr size_t AUTO_CLUSTERS_SIZE_SAMPLES = 4;
+// How often a measurement disturbed according to the perf_event counters is repeated before its result is used anyway.
+constexpr size_t DARE_MAX_REMEASUREMENTS = 8;
+// How many random superpages are searched for an address in a given bank before giving up (e.g., because the functions
+// depend on bits that are the same in all superpages, or are linearly dependent).
+constexpr size_t FIND_ADDRESS_MAX_ATTEMPTS = 1024;
 
 // Configuration for brute-forcing.
 constexpr size_t BRUTE_FORCE_MAX_BITS = 10;
@@ -12,3 +30,44 @@ constexpr size_t BRUTE_FORCE_LSB = 6;
 // Which percentage of all addresses in the cluster need to have the same value
 // for the function to be considered "constant enough" over the entire cluster.
 constexpr int BRUTE_FORCE_PASS_THRESHOLD_PERCENTAGE = 80;
+// Expected fraction of misclustered addresses, used when scoring functions by their likelihood.
+constexpr double SOLVER_NOISE_RATE = 0.1;
+// Number of consecutive snapshots of the clusters the pipelined solver has to find the same (complete) functions on
+// before building clusters stops early.
+constexpr size_t PIPELINE_STABLE_SNAPSHOTS = 3;
+
+// Configuration for classifying the functions found.
+constexpr size_t CLASSIFY_PAIRS_PER_FUNCTION = 256;
+// Addresses loaded at once to measure contention, spread over this many threads (a single core cannot have enough
+// loads in flight to saturate even one channel).
+constexpr size_t CLASSIFY_CONTENTION_ADDRS = 256;
+constexpr size_t CLASSIFY_CONTENTION_THREADS = 4;
+// Minimum speedup of spreading accesses over both outputs of a function (compared to keeping them on one output) for
+// the function to be considered a channel function.
+constexpr double CLASSIFY_CHANNEL_SPEEDUP = 1.3;
+// Minimum gap between the median pair latencies of two functions for them to be on different levels, in standard
+// errors of the difference of the medians (estimated from the MADs of the pair latencies).
+constexpr double CLASSIFY_LEVEL_GAP_SIGMAS = 4.0;
+
+// Measurement budget of a run. The defaults are conservative, dare_bench can be used to find cheaper settings.
+struct dare_params {
+    size_t threshold_samples { DARE_THRESHOLD_SAMPLES };
+    size_t addrs_per_cluster { DARE_ADDRS_PER_CLUSTER };
+    size_t iterations { DARE_ITERATIONS };
+    size_t accesses_per_iter { DARE_ACCESSES_PER_ITER };
+};
+
+// With a time budget: the share of the time each phase gets (relative to the phases after it, when it starts), and the
+// minimum number of threshold samples taken even if the threshold phase runs out of time.
+constexpr double TIME_BUDGET_SHARE_THRESHOLD = 0.15;
+constexpr double TIME_BUDGET_SHARE_CLUSTERS = 0.6;
+constexpr double TIME_BUDGET_SHARE_SOLVE = 0.2;
+constexpr double TIME_BUDGET_SHARE_CLASSIFY = 0.05;
+constexpr size_t TIME_BUDGET_MIN_THRESHOLD_SAMPLES = 1024;
+// Number of random address pairs timed to estimate how long a measurement takes.
+constexpr size_t TIME_BUDGET_COST_PAIRS = 256;
+
+// Configuration for verifying a known mapping.
+constexpr size_t VERIFY_PAIRS = 1024;
+// Minimum percentage of same-bank pairs that must conflict, and of different-bank pairs that must not conflict.
+constexpr double VERIFY_PASS_PERCENTAGE = 90.0;
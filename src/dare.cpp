@@ -1,29 +1,59 @@
 #include <argagg.hpp>
+#include <algorithm>
+#include <chrono>
 #include <iostream>
+#include <mutex>
 #include <optional>
+#include <thread>
 
 #include "analyzer.hpp"
+#include "budget.hpp"
+#include "numa.hpp"
+#include "pipeline.hpp"
 #include "solver.hpp"
+#include "translator.hpp"
 #include "utils.hpp"
 
 struct {
     size_t num_superpages { 0 };
-    size_t num_clusters { 0 };
+    std::optional<size_t> num_clusters;
     std::optional<uint64_t> row_conflict_threshold;
     size_t address_offset_mb { 0 };
     bool log_verbose { false };
+    bool perf_noise { false };
+    bool classify { false };
+    bool pipeline { false };
+    bool numa { true };
     std::optional<std::string> hist_out_file;
     std::optional<std::string> out_file;
+    std::optional<std::string> verify_file;
+    size_t row_mask { 0 };
+    std::optional<std::string> mapping_out_file;
+    std::optional<size_t> max_outlier_clusters;
+    std::optional<std::string> kernel;
+    std::optional<double> time_budget_seconds;
 } args;
 
+// All nodes share the same budget, counted from the start of the program.
+static auto const start_time = std::chrono::steady_clock::now();
+
 void parse_args(int argc, char** argv) {
     argagg::parser parser { { { "help", { "-h", "--help" }, "show help", 0 },
         { "superpages", { "--superpages" }, "number of superpages to allocate", 1 },
-        { "clusters", { "--clusters" }, "expected number of clusters (i.e., channels * ranks * bank groups * banks * ...)", 1 },
+        { "clusters", { "--clusters" }, "expected number of clusters (i.e., channels * ranks * bank groups * banks * ...; default: auto)", 1 },
         { "threshold", { "--threshold" }, "row conflict threshold (in cycles, default: auto)", 1 },
         { "offset", { "--offset" }, "offset between physical and DRAM addresses (in MiB, default: 0)", 1 },
         { "hist_out", { "--hist-out" }, "file to histgram data to (in CSV format)", 1 },
         { "out", { "--out" }, "file to save clusters to (in CSV format)", 1 },
+        { "max_outliers", { "--max-outliers" }, "score functions by likelihood, tolerating this many outlier clusters (default: strict)", 1 },
+        { "mapping_out", { "--mapping-out" }, "file to save the mapping descriptor to (see src/translator.hpp)", 1 },
+        { "verify", { "--verify" }, "only check the mapping in the given file (descriptor, or one hex mask per line) against the hardware", 1 },
+        { "pipeline", { "--pipeline" }, "solve on a background thread while building clusters and stop once the functions are stable (uses a second CPU)", 0 },
+        { "time_budget", { "--time-budget" }, "wall-clock budget for the analysis (in seconds); measurement parameters are scaled to fit it, and a partial result is reported if time runs out", 1 },
+        { "kernel", { "--kernel" }, "measurement kernel, e.g., cpuid-clflush or lfence-clflushopt (default: auto)", 1 },
+        { "no_numa", { "--no-numa" }, "allocate on any NUMA node, instead of analyzing every node separately (with --superpages on each)", 0 },
+        { "classify", { "--classify" }, "determine which functions select the channel, rank, bank group and bank", 0 },
+        { "perf_noise", { "--perf-noise" }, "reject measurements disturbed according to perf_event counters", 0 },
         { "verbose", { "-v", "--verbose" }, "be verbose", 0 } } };
 
     argagg::parser_results parsed_args;
@@ -46,11 +76,14 @@ void parse_args(int argc, char** argv) {
     }
     args.num_superpages = parsed_args["superpages"].as<size_t>();
 
-    if (!parsed_args.has_option("clusters")) {
-        LOG_ERROR("Error: Argument '--clusters' is required.\n");
-        exit(EXIT_FAILURE);
+    if (parsed_args.has_option("verify")) {
+        args.verify_file.emplace(parsed_args["verify"].as<std::string>());
+    }
+
+    // Without this, the number of clusters is estimated (or, when verifying, follows from the number of functions).
+    if (parsed_args.has_option("clusters")) {
+        args.num_clusters.emplace(parsed_args["clusters"].as<size_t>());
     }
-    args.num_clusters = parsed_args["clusters"].as<size_t>();
 
     if (parsed_args.has_option("threshold")) {
         args.row_conflict_threshold.emplace(parsed_args["threshold"].as<uint64_t>());
@@ -74,26 +107,348 @@ void parse_args(int argc, char** argv) {
         args.out_file.emplace(parsed_args["out"].as<std::string>());
     }
 
+    if (parsed_args.has_option("max_outliers")) {
+        args.max_outlier_clusters.emplace(parsed_args["max_outliers"].as<size_t>());
+    }
+
+    if (parsed_args.has_option("time_budget")) {
+        args.time_budget_seconds.emplace(parsed_args["time_budget"].as<double>());
+        if (*args.time_budget_seconds <= 0) {
+            LOG_ERROR("Error: The time budget must be positive.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (parsed_args.has_option("kernel")) {
+        args.kernel.emplace(parsed_args["kernel"].as<std::string>());
+        auto names = hardware_timing_source::kernel_names();
+        if (std::find(names.begin(), names.end(), *args.kernel) == names.end()) {
+            LOG_ERROR("Error: Unknown kernel '%s'. Available kernels:\n", args.kernel->c_str());
+            for (auto const& name : names) {
+                LOG_ERROR("    %s\n", name.c_str());
+            }
+            exit(EXIT_FAILURE);
+        }
+    } else if (args.row_conflict_threshold.has_value()) {
+        // A threshold from an earlier run only fits the kernel that run used, which was the original one.
+        args.kernel.emplace(hardware_timing_source::kernel_names().front());
+    }
+
+    if (parsed_args.has_option("mapping_out")) {
+        args.mapping_out_file.emplace(parsed_args["mapping_out"].as<std::string>());
+    }
+
+    args.classify = parsed_args.has_option("classify");
+    args.pipeline = parsed_args.has_option("pipeline");
+    args.numa = !parsed_args.has_option("no_numa");
+    args.perf_noise = parsed_args.has_option("perf_noise");
     args.log_verbose = parsed_args.has_option("verbose");
 }
 
-int main(int argc, char** argv) {
-    parse_args(argc, argv);
-    log_verbose = args.log_verbose;
+// In runs on multiple NUMA nodes, every node gets its own output files, e.g., "clusters.node1.csv".
+static std::optional<std::string> node_file(std::optional<std::string> const& file, std::optional<size_t> node) {
+    if (!file.has_value() || !node.has_value()) {
+        return file;
+    }
+    auto suffix = ".node" + std::to_string(*node);
+    auto extension = file->rfind('.');
+    if (extension == std::string::npos || file->find('/', extension) != std::string::npos) {
+        return *file + suffix;
+    }
+    return file->substr(0, extension) + suffix + file->substr(extension);
+}
+
+// Nodes are analyzed concurrently, but their results are printed one node at a time.
+static std::mutex output_mutex;
+
+static void print_node_header(std::optional<size_t> node) {
+    if (node.has_value()) {
+        printf("Results for NUMA node %zu:\n", *node);
+    }
+}
+
+static bool save_mapping(std::string const& out_file, std::vector<func_t> const& functions, std::vector<func_label> const& labels) {
+    mapping_descriptor descriptor;
+    descriptor.phys_dram_offset = args.address_offset_mb * MiB;
+    descriptor.functions.assign(functions.begin(), functions.end());
+    for (auto label : labels) {
+        // Labels are single words in the descriptor.
+        std::string name = func_label_name(label);
+        std::replace(name.begin(), name.end(), ' ', '_');
+        descriptor.labels.push_back(std::move(name));
+    }
+
+    if (!descriptor.save(out_file.c_str())) {
+        perror("save");
+        LOG_ERROR("Error: Could not write mapping descriptor to '%s'.\n", out_file.c_str());
+        return false;
+    }
+    LOG("Wrote mapping descriptor to '%s'.\n", out_file.c_str());
+    return true;
+}
+
+// Loads a known mapping, given as a descriptor or as one hex mask per line. A descriptor also sets the offset and the
+// row mask.
+static std::vector<func_t> load_functions(std::string const& file) {
+    std::vector<func_t> functions;
+    if (auto descriptor = mapping_descriptor::load(file.c_str())) {
+        functions.assign(descriptor->functions.begin(), descriptor->functions.end());
+        args.address_offset_mb = descriptor->phys_dram_offset / MiB;
+        args.row_mask = descriptor->row_mask;
+    } else {
+        functions = func_read_file(file.c_str());
+    }
+    if (functions.empty()) {
+        LOG_ERROR("Error: No functions found in '%s'.\n", file.c_str());
+        exit(EXIT_FAILURE);
+    }
+    if (!func_are_linearly_independent(functions)) {
+        LOG_ERROR("Error: The functions in '%s' are not linearly independent.\n", file.c_str());
+        exit(EXIT_FAILURE);
+    }
+    return functions;
+}
 
-    analyzer analyzer(args.num_superpages);
+static int verify(analyzer& analyzer, std::vector<func_t> const& functions, std::optional<size_t> node) {
     if (args.row_conflict_threshold) {
         analyzer.set_row_conflict_threshold(*args.row_conflict_threshold);
     } else {
-        analyzer.find_row_conflict_threshold(args.num_clusters, args.hist_out_file);
+        analyzer.find_row_conflict_threshold(args.num_clusters, node_file(args.hist_out_file, node));
+    }
+
+    auto result = analyzer.verify_functions(functions, args.address_offset_mb * MiB, VERIFY_PAIRS, args.row_mask);
+    if (!result.has_value()) {
+        return EXIT_FAILURE;
+    }
+
+    std::lock_guard lock(output_mutex);
+    print_node_header(node);
+    analyzer.print_noise_stats();
+    result->print();
+    return result->passed() ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static int analyze(analyzer& analyzer, std::optional<size_t> node) {
+    std::optional<time_budget> budget;
+    if (args.time_budget_seconds.has_value()) {
+        budget.emplace(start_time, *args.time_budget_seconds);
+        // Without a number of clusters, the initial guess is used. If there are more, the deadlines still hold.
+        auto seconds_per_access = analyzer.seconds_per_access(TIME_BUDGET_COST_PAIRS);
+        auto expected_num_clusters = args.num_clusters.value_or(AUTO_CLUSTERS_INITIAL_GUESS);
+        analyzer.set_params(budget->scale_params(analyzer.params(), seconds_per_access, expected_num_clusters));
+        analyzer.set_deadline(budget->start_phase(time_budget::THRESHOLD));
+    }
+
+    if (args.row_conflict_threshold) {
+        analyzer.set_row_conflict_threshold(*args.row_conflict_threshold);
+    } else {
+        analyzer.find_row_conflict_threshold(args.num_clusters, node_file(args.hist_out_file, node));
+    }
+
+    // Solve on the clusters built so far while building more, and stop building once the functions are stable. The
+    // scored solver needs all clusters to tell outliers apart.
+    std::optional<pipelined_solver> pipeline;
+    bool stopped_early = false;
+    auto expected_num_clusters = args.num_clusters.has_value() ? args.num_clusters : analyzer.estimated_num_clusters();
+    if (args.pipeline && !args.max_outlier_clusters.has_value() && expected_num_clusters.has_value()) {
+        pipeline.emplace(args.address_offset_mb * MiB, *expected_num_clusters);
+        analyzer.set_cluster_callback([&](auto const& clusters) {
+            stopped_early = pipeline->submit(clusters);
+            return stopped_early;
+        });
+    }
+
+    if (budget.has_value()) {
+        auto deadline = budget->start_phase(time_budget::CLUSTERS);
+        analyzer.set_deadline(deadline);
+        // The worker's result is only used if it is stable before building ends.
+        if (pipeline.has_value()) {
+            pipeline->set_deadline(deadline);
+        }
+    }
+    if (!analyzer.build_clusters(args.num_clusters)) {
+        return EXIT_FAILURE;
+    }
+    // Unless the worker stopped building early, its result is not used. Stop it, so it neither competes with the final
+    // solve nor has to be waited for.
+    if (!stopped_early) {
+        pipeline.reset();
+    }
+    if (analyzer.clusters().size() < 2) {
+        LOG_ERROR("Error: Ran out of time before two clusters were built. Cannot continue.\n");
+        return EXIT_FAILURE;
     }
-    analyzer.build_clusters(args.num_clusters);
 
-    if (args.out_file.has_value()) {
-        analyzer.dump_clusters(*args.out_file);
+    if (auto out_file = node_file(args.out_file, node)) {
+        if (!analyzer.dump_clusters(*out_file)) {
+            return EXIT_FAILURE;
+        }
     }
 
+    // Solving and classifying (which measures) do not hold the output lock, so the other nodes are not held up. The
+    // results are printed at the end.
     solver solver(analyzer.clusters());
-    (void)solver.find_bank_functions(args.address_offset_mb * MiB);
-    return 0;
+    deadline_t solve_deadline;
+    if (budget.has_value()) {
+        solve_deadline = budget->start_phase(time_budget::SOLVE);
+        solver.set_deadline(solve_deadline);
+    }
+    std::vector<func_t> functions;
+    std::vector<scored_func> scored_functions;
+    auto partial = analyzer.timed_out() && !stopped_early;
+
+    // Without --clusters, the number of clusters has to be a power of two that agrees with the number of functions
+    // found. Otherwise, clusters of the same bank are merged (and, after solving, the functions are searched again).
+    auto settle_clusters = !args.num_clusters.has_value() && !partial && !stopped_early;
+    auto num_built = analyzer.clusters().size();
+    if (settle_clusters && (num_built & (num_built - 1)) != 0) {
+        if (!analyzer.settle_clusters(args.address_offset_mb * MiB, solve_deadline)) {
+            LOG_ERROR("Error: Could not settle on a number of clusters. Cannot continue.\n");
+            return EXIT_FAILURE;
+        }
+        solver.set_clusters(analyzer.clusters());
+    }
+    if (partial) {
+        // Only some of the clusters were built, so the functions cannot be 1 on exactly half of them. k clusters can
+        // only tell k - 1 functions apart, and there cannot be more functions than the expected clusters need; keep
+        // the ones with the fewest bits, which are the most likely to be actual functions.
+        functions = solver.find_bank_functions_subset(args.address_offset_mb * MiB);
+        auto max_functions = analyzer.clusters().size() - 1;
+        if (expected_num_clusters.has_value()) {
+            max_functions = std::min(max_functions, msb_set(*expected_num_clusters));
+        }
+        if (functions.size() > max_functions) {
+            functions.resize(max_functions);
+        }
+    } else if (stopped_early) {
+        functions = *pipeline->result();
+    } else if (args.max_outlier_clusters.has_value()) {
+        scored_functions = solver.find_bank_functions_scored(args.address_offset_mb * MiB, *args.max_outlier_clusters);
+        for (auto const& scored : scored_functions) {
+            functions.push_back(scored.func);
+        }
+    } else {
+        functions = solver.find_bank_functions(args.address_offset_mb * MiB);
+        auto disagrees = BIT(functions.size()) != analyzer.clusters().size() && solver.search_completed();
+        if (settle_clusters && disagrees && analyzer.settle_clusters(args.address_offset_mb * MiB, solve_deadline)) {
+            solver.set_clusters(analyzer.clusters());
+            functions = solver.find_bank_functions(args.address_offset_mb * MiB);
+        }
+    }
+
+    std::vector<func_label> labels;
+    if (args.classify && !functions.empty() && budget.has_value() && budget->expired()) {
+        LOG("Out of time, not classifying the functions.\n");
+    } else if (args.classify && !functions.empty()) {
+        if (budget.has_value()) {
+            analyzer.set_deadline(budget->start_phase(time_budget::CLASSIFY));
+        }
+        labels = analyzer.classify_functions(functions, args.address_offset_mb * MiB);
+    }
+
+    // Other tools trust a descriptor, so an incomplete result is not written.
+    auto saved = true;
+    if (auto mapping_out_file = node_file(args.mapping_out_file, node)) {
+        auto complete = !partial && (stopped_early || solver.search_completed());
+        if (complete) {
+            saved = save_mapping(*mapping_out_file, functions, labels);
+        } else {
+            LOG_ERROR("Error: Not writing the mapping descriptor to '%s', as the result is incomplete.\n", mapping_out_file->c_str());
+            saved = false;
+        }
+    }
+
+    std::lock_guard lock(output_mutex);
+    print_node_header(node);
+    analyzer.print_noise_stats();
+    if (partial) {
+        printf("Found %zu functions on the %zu clusters built in time (partial result):\n", functions.size(), analyzer.clusters().size());
+        func_print_all(functions);
+    } else if (stopped_early) {
+        printf("Found %zu functions (up to %zu bits, unchanged over the last %zu of %zu clusters):\n", functions.size(),
+            BRUTE_FORCE_MAX_BITS, PIPELINE_STABLE_SNAPSHOTS, analyzer.clusters().size());
+        func_print_all(functions);
+    } else if (args.max_outlier_clusters.has_value()) {
+        solver.print_scored_functions(scored_functions);
+    } else {
+        solver.print_functions(functions);
+    }
+
+    // n independent functions select one of 2^n banks, so this has to match the number of clusters.
+    auto clusters_incomplete = stopped_early || analyzer.timed_out();
+    auto num_clusters = clusters_incomplete && expected_num_clusters.has_value() ? *expected_num_clusters : analyzer.clusters().size();
+    if (BIT(functions.size()) != num_clusters) {
+        LOG_ERROR("Warning: Found %zu functions, but %zu clusters would require %zu functions.%s\n", functions.size(),
+            num_clusters, msb_set(num_clusters), args.num_clusters.has_value() ? "" : " The estimated number of clusters may be wrong.");
+    } else if (!args.num_clusters.has_value()) {
+        LOG("Number of clusters (%zu) agrees with the number of functions found.\n", num_clusters);
+    }
+
+    if (!labels.empty()) {
+        func_print_hierarchy(functions, labels);
+    }
+    return saved ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// Runs the analysis (or verification) on the calling thread. With a NUMA node, the thread is moved to the node's CPUs
+// and all memory is allocated from the node, so all measurements are node-local.
+static int run(std::optional<size_t> node, std::vector<func_t> const& known_functions) {
+    if (node.has_value()) {
+        snprintf(log_prefix, sizeof(log_prefix), "[node %zu] ", *node);
+    }
+    if (node.has_value() && !numa::run_on_node(*node)) {
+        LOG_ERROR("Warning: Could not move the measurement thread of NUMA node %zu to that node.\n", *node);
+    }
+
+    analyzer analyzer(args.num_superpages, node, args.kernel);
+    if (args.perf_noise) {
+        analyzer.enable_noise_detection();
+    }
+    if (args.verify_file.has_value()) {
+        return verify(analyzer, known_functions, node);
+    }
+    return analyze(analyzer, node);
+}
+
+int main(int argc, char** argv) {
+    parse_args(argc, argv);
+    log_verbose = args.log_verbose;
+
+    std::vector<func_t> known_functions;
+    if (args.verify_file.has_value()) {
+        known_functions = load_functions(*args.verify_file);
+        if (!args.num_clusters.has_value()) {
+            args.num_clusters.emplace(BIT(known_functions.size()));
+        }
+    }
+
+    std::vector<size_t> nodes;
+    if (args.numa) {
+        nodes = numa::memory_nodes();
+    }
+    if (nodes.size() <= 1) {
+        return run({}, known_functions);
+    }
+
+    for (auto node : nodes) {
+        auto free_superpages = numa::free_superpages(node);
+        if (free_superpages.has_value() && *free_superpages < args.num_superpages) {
+            LOG_ERROR("Error: NUMA node %zu only has %zu free superpages, but %zu are needed on each node.\n", node,
+                *free_superpages, args.num_superpages);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    LOG("Analyzing %zu NUMA nodes concurrently, with %zu superpages each.\n", nodes.size(), args.num_superpages);
+    std::vector<int> results(nodes.size());
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < nodes.size(); i++) {
+        threads.emplace_back([&, i] { results[i] = run(nodes[i], known_functions); });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    auto all_passed = std::all_of(results.begin(), results.end(), [](int result) { return result == EXIT_SUCCESS; });
+    return all_passed ? EXIT_SUCCESS : EXIT_FAILURE;
 }
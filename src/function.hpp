@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <array>
 #include <cstdint>
 #include <cstdio>
@@ -13,6 +14,30 @@ using bin_t = uint8_t;
 using func_t = size_t;
 constexpr size_t FUNC_NUM_BITS = 8 * sizeof(func_t);
 
+// Which part of the DRAM hierarchy a function selects.
+enum class func_label {
+    unknown,
+    channel,
+    rank,
+    bank_group,
+    bank,
+};
+
+[[maybe_unused]] static char const* func_label_name(func_label label) {
+    switch (label) {
+    case func_label::channel:
+        return "channel";
+    case func_label::rank:
+        return "rank";
+    case func_label::bank_group:
+        return "bank group";
+    case func_label::bank:
+        return "bank";
+    default:
+        return "unknown";
+    }
+}
+
 [[maybe_unused]] static void func_print(func_t func) {
     printf("0x%010zx (", func);
 
@@ -30,6 +55,82 @@ constexpr size_t FUNC_NUM_BITS = 8 * sizeof(func_t);
     printf(")\n");
 }
 
+[[maybe_unused]] static void func_print_all(std::vector<func_t> const& funcs) {
+    if (funcs.empty()) {
+        return;
+    }
+
+    func_t all_xored = 0;
+    for (auto func : funcs) {
+        all_xored ^= func;
+        func_print(func);
+    }
+
+    printf("XOR of all found functions:\n");
+    func_print(all_xored);
+}
+
+// Prints the functions grouped by the part of the DRAM hierarchy they select, from the top of the hierarchy down.
+[[maybe_unused]] static void func_print_hierarchy(std::vector<func_t> const& funcs, std::vector<func_label> const& labels) {
+    constexpr std::array<func_label, 5> LEVELS { func_label::channel, func_label::rank, func_label::bank_group,
+        func_label::bank, func_label::unknown };
+
+    printf("DRAM address mapping hierarchy:\n");
+    for (auto level : LEVELS) {
+        size_t count = std::count(labels.begin(), labels.end(), level);
+        if (count == 0 && level == func_label::unknown) {
+            continue;
+        }
+        printf("  %s (%zu functions)\n", func_label_name(level), count);
+        for (size_t i = 0; i < funcs.size(); i++) {
+            if (labels[i] == level) {
+                printf("    ");
+                func_print(funcs[i]);
+            }
+        }
+    }
+}
+
+// Reads functions from a file in the formats printed by DARE: one function per line as written by func_print, either
+// at the start of the line, indented (as in the hierarchy) or after "confidence ...: " (as with --max-outliers). Only
+// the leading hex mask is used. The XOR of all functions (printed after them), repeated functions and all other lines
+// (e.g., comments) are ignored.
+[[maybe_unused]] static std::vector<func_t> func_read_file(char const* path) {
+    FILE* fp = fopen(path, "r");
+    if (!fp) {
+        perror("fopen");
+        LOG_ERROR("Error: Could not open functions file '%s'.\n", path);
+        exit(EXIT_FAILURE);
+    }
+
+    std::vector<func_t> funcs;
+    char line[256];
+    bool after_xor_header = false;
+    while (fgets(line, sizeof(line), fp)) {
+        bool is_xor = after_xor_header;
+        after_xor_header = strncmp(line, "XOR of all", 10) == 0;
+
+        char* start = line + strspn(line, " \t");
+        if (strncmp(start, "confidence", 10) == 0) {
+            if (auto* colon = strstr(start, ": ")) {
+                start = colon + 2;
+            }
+        }
+        if (is_xor || strncmp(start, "0x", 2) != 0) {
+            continue;
+        }
+
+        char* end = nullptr;
+        auto func = (func_t)strtoull(start, &end, 16);
+        if (end != start && func != 0 && std::find(funcs.begin(), funcs.end(), func) == funcs.end()) {
+            funcs.push_back(func);
+        }
+    }
+    fclose(fp);
+
+    return funcs;
+}
+
 [[maybe_unused]] static void func_print_bits(func_t func) {
     printf("MSB -> LSB:");
     for (ssize_t i = FUNC_NUM_BITS - 1; i >= 0; i--) {
@@ -54,6 +155,15 @@ constexpr size_t FUNC_NUM_BITS = 8 * sizeof(func_t);
     return __builtin_parityll(func & (uintptr_t)addr);
 }
 
+// Applies all functions to the address; the result of the i-th function ends up in bit i (i.e., the bank index).
+[[maybe_unused]] static size_t func_apply_all(std::vector<func_t> const& funcs, uintptr_t addr) {
+    size_t result = 0;
+    for (size_t i = 0; i < funcs.size(); i++) {
+        result |= size_t(func_apply(funcs[i], addr)) << i;
+    }
+    return result;
+}
+
 [[maybe_unused]] static func_t func_set_bit(func_t func, size_t bit_idx) {
     return func | (func_t(1) << bit_idx);
 }
@@ -83,9 +193,8 @@ constexpr size_t FUNC_NUM_BITS = 8 * sizeof(func_t);
     return w;
 }
 
-[[maybe_unused]] static bool func_are_linearly_independent(std::vector<func_t> funcs) {
-    // Do Gaussian elimination in GF(2). If at the end, there is still full
-    // rank, the functions are linearly independent.
+[[maybe_unused]] static size_t func_rank(std::vector<func_t> funcs) {
+    // Do Gaussian elimination in GF(2). The number of non-zero rows at the end is the rank.
 
     size_t rank = 0;
     for (ssize_t bit = 8 * sizeof(func_t) - 1; bit >= 0; bit--) {
@@ -122,5 +231,18 @@ constexpr size_t FUNC_NUM_BITS = 8 * sizeof(func_t);
         }
     }
 
-    return rank == funcs.size();
+    return rank;
+}
+
+[[maybe_unused]] static bool func_are_linearly_independent(std::vector<func_t> const& funcs) {
+    // If there is still full rank after Gaussian elimination, the functions are linearly independent.
+    return func_rank(funcs) == funcs.size();
+}
+
+// Returns true if both sets of functions span the same space, i.e., they describe the same bank mapping.
+[[maybe_unused]] static bool func_spans_equal(std::vector<func_t> const& first, std::vector<func_t> const& second) {
+    auto combined = first;
+    combined.insert(combined.end(), second.begin(), second.end());
+    auto rank = func_rank(first);
+    return rank == func_rank(second) && rank == func_rank(combined);
 }
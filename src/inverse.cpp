@@ -0,0 +1,149 @@
+#include <cassert>
+
+#include "inverse.hpp"
+
+inverse_mapper::inverse_mapper(std::vector<func_t> functions, size_t phys_dram_offset, size_t row_mask, size_t granularity)
+    : m_functions(std::move(functions))
+    , m_phys_dram_offset(phys_dram_offset)
+    , m_row_mask(row_mask)
+    , m_granularity_bits(__builtin_ctzll(granularity)) {
+    assert(granularity > 0 && (granularity & (granularity - 1)) == 0);
+}
+
+size_t inverse_mapper::largest_block_bits(uintptr_t start, uintptr_t end) {
+    assert(start < end);
+    auto bits = start == 0 ? FUNC_NUM_BITS - 1 : (size_t)__builtin_ctzll(start);
+    while (BIT(bits) > end - start) {
+        bits--;
+    }
+    return bits;
+}
+
+std::optional<inverse_mapper::solution_space> inverse_mapper::solve(uintptr_t block_start, size_t block_bits, size_t bank, std::optional<size_t> row) const {
+    if (block_bits < m_granularity_bits) {
+        return {};
+    }
+    auto free_mask = (BIT(block_bits) - 1) & ~(BIT(m_granularity_bits) - 1);
+
+    // Each equation says that the parity of the free bits in `mask` must be `value`. The fixed bits of the block are
+    // already accounted for in `value`.
+    std::vector<std::pair<uintptr_t, uint8_t>> equations;
+    for (size_t i = 0; i < m_functions.size(); i++) {
+        auto value = uint8_t(((bank >> i) & 1) ^ func_apply(m_functions[i], block_start));
+        equations.emplace_back(m_functions[i] & free_mask, value);
+    }
+    if (row.has_value()) {
+        size_t row_bit = 0;
+        for (size_t bit = 0; bit < FUNC_NUM_BITS; bit++) {
+            if (!(m_row_mask & BIT(bit))) {
+                continue;
+            }
+            auto value = uint8_t(((*row >> row_bit) & 1) ^ ((block_start >> bit) & 1));
+            equations.emplace_back(BIT(bit) & free_mask, value);
+            row_bit++;
+        }
+    }
+
+    // Gaussian elimination in GF(2) to reduced row echelon form.
+    std::vector<size_t> pivot_bits;
+    size_t rank = 0;
+    for (ssize_t bit = FUNC_NUM_BITS - 1; bit >= 0; bit--) {
+        size_t pivot = -1;
+        for (size_t i = rank; i < equations.size(); i++) {
+            if (equations[i].first & BIT(bit)) {
+                pivot = i;
+                break;
+            }
+        }
+        if (pivot == (size_t)-1) {
+            continue;
+        }
+        std::swap(equations[rank], equations[pivot]);
+        for (size_t i = 0; i < equations.size(); i++) {
+            if (i != rank && (equations[i].first & BIT(bit))) {
+                equations[i].first ^= equations[rank].first;
+                equations[i].second ^= equations[rank].second;
+            }
+        }
+        pivot_bits.push_back(bit);
+        rank++;
+    }
+
+    // Any remaining equation without free bits has to be trivially satisfied.
+    for (size_t i = rank; i < equations.size(); i++) {
+        if (equations[i].second) {
+            return {};
+        }
+    }
+
+    // Particular solution: all non-pivot bits zero, so each pivot bit is the value of its equation.
+    solution_space solutions { block_start, {} };
+    uintptr_t pivot_mask = 0;
+    for (size_t i = 0; i < rank; i++) {
+        pivot_mask |= BIT(pivot_bits[i]);
+        if (equations[i].second) {
+            solutions.particular |= BIT(pivot_bits[i]);
+        }
+    }
+
+    // Null space: flipping a non-pivot bit requires flipping the pivot bits of all equations that contain it.
+    for (size_t bit = m_granularity_bits; bit < block_bits; bit++) {
+        if (pivot_mask & BIT(bit)) {
+            continue;
+        }
+        auto vector = BIT(bit);
+        for (size_t i = 0; i < rank; i++) {
+            if (equations[i].first & BIT(bit)) {
+                vector |= BIT(pivot_bits[i]);
+            }
+        }
+        solutions.basis.push_back(vector);
+    }
+
+    return solutions;
+}
+
+size_t inverse_mapper::row(uintptr_t phys) const {
+    auto dram = phys - m_phys_dram_offset;
+    size_t row = 0;
+    size_t row_bit = 0;
+    for (size_t bit = 0; bit < FUNC_NUM_BITS; bit++) {
+        if (m_row_mask & BIT(bit)) {
+            row |= ((dram >> bit) & 1) << row_bit;
+            row_bit++;
+        }
+    }
+    return row;
+}
+
+std::optional<uintptr_t> inverse_mapper::sample(uintptr_t phys_start, size_t size, uintptr_t phys_hint, size_t bank,
+    std::optional<size_t> row, std::default_random_engine& generator) const {
+    assert(phys_hint >= phys_start && phys_hint < phys_start + size);
+    if (phys_start < m_phys_dram_offset) {
+        return {};
+    }
+
+    // Find the block that enumerate() would use for the hint.
+    auto dram = phys_start - m_phys_dram_offset;
+    auto dram_end = dram + size;
+    auto dram_hint = phys_hint - m_phys_dram_offset;
+    auto block_bits = largest_block_bits(dram, dram_end);
+    while (dram + BIT(block_bits) <= dram_hint) {
+        dram += BIT(block_bits);
+        block_bits = largest_block_bits(dram, dram_end);
+    }
+
+    auto solutions = solve(dram, block_bits, bank, row);
+    if (!solutions) {
+        return {};
+    }
+
+    std::bernoulli_distribution coin;
+    auto addr = solutions->particular;
+    for (auto vector : solutions->basis) {
+        if (coin(generator)) {
+            addr ^= vector;
+        }
+    }
+    return addr + m_phys_dram_offset;
+}
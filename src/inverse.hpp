@@ -0,0 +1,79 @@
+#include <optional>
+#include <random>
+
+#include "function.hpp"
+
+#pragma once
+
+// Enumerates the addresses that map to a given bank (and optionally row) by solving the GF(2) system given by the
+// functions directly, instead of testing random addresses.
+class inverse_mapper {
+public:
+    // The functions are applied to DRAM addresses, i.e., physical addresses minus phys_dram_offset. The row of an
+    // address (if used) is made up of the bits in row_mask, in order. Only addresses that are a multiple of
+    // granularity are returned.
+    inverse_mapper(std::vector<func_t> functions, size_t phys_dram_offset, size_t row_mask = 0, size_t granularity = 64);
+
+    // Calls callback(phys) for every address in [phys_start, phys_start + size) that maps to the bank (and row).
+    // Stops early and returns false as soon as the callback returns false.
+    template <typename Callback>
+    bool enumerate(uintptr_t phys_start, size_t size, size_t bank, std::optional<size_t> row, Callback&& callback) const;
+
+    // Returns a uniformly random address that maps to the bank (and row), out of the largest aligned block of
+    // physical memory around phys_hint that lies within [phys_start, phys_start + size), i.e., from the same block
+    // enumerate() would find it in. Returns nothing if there is no such address in this block.
+    [[nodiscard]] std::optional<uintptr_t> sample(uintptr_t phys_start, size_t size, uintptr_t phys_hint, size_t bank,
+        std::optional<size_t> row, std::default_random_engine& generator) const;
+
+    // Returns the row of an address, made up of its bits in row_mask (as passed to enumerate() and sample()).
+    [[nodiscard]] size_t row(uintptr_t phys) const;
+
+private:
+    // All solutions within a DRAM block: particular XOR any combination of the basis vectors.
+    struct solution_space {
+        uintptr_t particular;
+        std::vector<uintptr_t> basis;
+    };
+
+    [[nodiscard]] std::optional<solution_space> solve(uintptr_t block_start, size_t block_bits, size_t bank, std::optional<size_t> row) const;
+    [[nodiscard]] static size_t largest_block_bits(uintptr_t start, uintptr_t end);
+
+    std::vector<func_t> m_functions;
+    size_t m_phys_dram_offset;
+    size_t m_row_mask;
+    size_t m_granularity_bits;
+};
+
+template <typename Callback>
+bool inverse_mapper::enumerate(uintptr_t phys_start, size_t size, size_t bank, std::optional<size_t> row, Callback&& callback) const {
+    if (phys_start < m_phys_dram_offset) {
+        // Not backed by DRAM addresses the functions apply to.
+        return true;
+    }
+
+    // The functions are linear in the DRAM address, so the range is split into aligned blocks in which only the low
+    // bits change.
+    auto dram = phys_start - m_phys_dram_offset;
+    auto dram_end = dram + size;
+    while (dram < dram_end) {
+        auto block_bits = largest_block_bits(dram, dram_end);
+        auto solutions = solve(dram, block_bits, bank, row);
+
+        if (solutions) {
+            // Walk through all combinations of the basis vectors in Gray code order, so every step is a single XOR.
+            auto addr = solutions->particular;
+            if (!callback(addr + m_phys_dram_offset)) {
+                return false;
+            }
+            for (size_t i = 1; i < BIT(solutions->basis.size()); i++) {
+                addr ^= solutions->basis[__builtin_ctzll(i)];
+                if (!callback(addr + m_phys_dram_offset)) {
+                    return false;
+                }
+            }
+        }
+
+        dram += BIT(block_bits);
+    }
+    return true;
+}
@@ -1,8 +1,10 @@
+#include "sched.h"
 #include "sys/mman.h"
+#include <algorithm>
 #include <cassert>
-#include <random>
 
 #include "memory.hpp"
+#include "numa.hpp"
 #include "pagemap.hpp"
 #include "utils.hpp"
 
@@ -10,6 +12,11 @@
 #define MAP_HUGE_1GB (30 << MAP_HUGE_SHIFT)
 
 memory::~memory() {
+    for (auto& thread : m_populate_threads) {
+        thread.join();
+    }
+    restore_affinity();
+
     if (m_ptr) {
         if (munmap(m_ptr, m_size) < 0) {
             perror("munmap");
@@ -18,14 +25,21 @@ memory::~memory() {
     }
 }
 
-void memory::allocate(size_t num_superpages) {
+void memory::allocate(size_t num_superpages, std::optional<size_t> numa_node) {
     assert(m_ptr == nullptr && m_size == 0);
+    assert(num_superpages > 0);
 
     m_size = num_superpages * SUPERPAGE;
-    LOG("[memory] Allocating %zu superpages (%zu bytes) of memory...\n", num_superpages, m_size);
+    if (numa_node.has_value()) {
+        LOG("[memory] Allocating %zu superpages (%zu bytes) of memory on NUMA node %zu...\n", num_superpages, m_size, *numa_node);
+    } else {
+        LOG("[memory] Allocating %zu superpages (%zu bytes) of memory...\n", num_superpages, m_size);
+    }
 
+    // No MAP_POPULATE here: hugetlb pages are reserved at mmap() time, so a lack of superpages is still reported
+    // immediately, but faulting (and zeroing) the superpages is left to the populating threads below.
     auto mmap_prot = PROT_READ | PROT_WRITE;
-    auto mmap_flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE | MAP_HUGETLB | MAP_HUGE_1GB;
+    auto mmap_flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_HUGE_1GB;
 
     m_ptr = (uint8_t*)mmap(nullptr, m_size, mmap_prot, mmap_flags, -1, 0);
 
@@ -36,57 +50,143 @@ void memory::allocate(size_t num_superpages) {
         exit(1);
     }
 
-    if (mlock(m_ptr, m_size) < 0) {
-        perror("mlock");
-        LOG("[allocate] Could not mlock() the allocation. Superuser privileges are required for this.\n");
+    // The superpages are only allocated when they are first touched, so the policy applies to all of them.
+    if (numa_node.has_value() && !numa::bind_memory(m_ptr, m_size, *numa_node)) {
+        LOG("[memory] Could not bind the allocation to NUMA node %zu.\n", *numa_node);
         exit(1);
     }
 
-    LOG_VERBOSE("[memory] Populating virtual-to-physical mappings.\n");
     for (size_t offset = 0; offset < m_size; offset += SUPERPAGE) {
-        auto* virt_base = m_ptr + offset;
+        m_virt_phys_mappings.emplace_back(m_ptr + offset, (uintptr_t)-1);
+    }
+    m_ready_superpages.resize(num_superpages);
+
+    // Measurements start before all superpages are populated, so the CPU this thread runs on is left to the
+    // measurements: this thread is pinned to it until all superpages are populated, and the populating threads use
+    // the remaining CPUs.
+    size_t num_cpus = std::max(2U, std::thread::hardware_concurrency());
+    cpu_set_t populate_cpus;
+    std::optional<cpu_set_t> populate_affinity;
+    if (sched_getaffinity(0, sizeof(populate_cpus), &populate_cpus) == 0) {
+        auto measuring_cpu = sched_getcpu();
+        num_cpus = CPU_COUNT(&populate_cpus);
+        if (measuring_cpu >= 0 && num_cpus > 1 && CPU_ISSET(measuring_cpu, &populate_cpus)) {
+            cpu_set_t measuring_cpus;
+            CPU_ZERO(&measuring_cpus);
+            CPU_SET(measuring_cpu, &measuring_cpus);
+            if (sched_setaffinity(0, sizeof(measuring_cpus), &measuring_cpus) < 0) {
+                perror("sched_setaffinity");
+            } else {
+                m_measuring_affinity = populate_cpus;
+            }
+
+            CPU_CLR(measuring_cpu, &populate_cpus);
+            populate_affinity = populate_cpus;
+        }
+    }
+
+    auto num_threads = std::min<size_t>(num_superpages, std::max<size_t>(1, num_cpus - 1));
+    LOG_VERBOSE("[memory] Populating superpages using %zu threads.\n", num_threads);
+    for (size_t i = 0; i < num_threads; i++) {
+        m_populate_threads.emplace_back([this, populate_affinity] {
+            if (populate_affinity.has_value() && sched_setaffinity(0, sizeof(*populate_affinity), &*populate_affinity) < 0) {
+                perror("sched_setaffinity");
+            }
+            populate_superpages();
+        });
+    }
+
+    // Measurements can start as soon as a single superpage is available.
+    std::unique_lock lock(m_ready_mutex);
+    m_ready_cv.wait(lock, [this] { return m_num_ready.load(std::memory_order_relaxed) > 0; });
+}
+
+void memory::populate_superpages() {
+    while (true) {
+        auto idx = m_next_to_populate.fetch_add(1);
+        if (idx >= m_virt_phys_mappings.size()) {
+            break;
+        }
+
+        auto* virt_base = m_virt_phys_mappings[idx].first;
+
+        // Touching the superpage faults it in, which makes the kernel zero it. This is the expensive part.
+        *(volatile uint8_t*)virt_base = 0;
+
+        if (mlock(virt_base, SUPERPAGE) < 0) {
+            perror("mlock");
+            LOG("[allocate] Could not mlock() the allocation. Superuser privileges are required for this.\n");
+            exit(1);
+        }
+
         auto phys_base = pagemap::virt_to_phys(virt_base);
-        m_virt_phys_mappings.emplace_back(virt_base, phys_base);
+        m_virt_phys_mappings[idx].second = phys_base;
         LOG_VERBOSE("    %p -> %p\n", virt_base, (void*)phys_base);
+
+        std::lock_guard lock(m_ready_mutex);
+        auto num_ready = m_num_ready.load(std::memory_order_relaxed);
+        m_ready_superpages[num_ready] = idx;
+        m_num_ready.store(num_ready + 1, std::memory_order_release);
+        m_ready_cv.notify_all();
+    }
+}
+
+void memory::wait_until_populated() {
+    {
+        std::unique_lock lock(m_ready_mutex);
+        m_ready_cv.wait(lock, [this] { return m_num_ready.load(std::memory_order_relaxed) == m_virt_phys_mappings.size(); });
+    }
+
+    for (auto& thread : m_populate_threads) {
+        thread.join();
+    }
+    m_populate_threads.clear();
+
+    restore_affinity();
+}
+
+void memory::restore_affinity() {
+    if (m_measuring_affinity.has_value()) {
+        if (sched_setaffinity(0, sizeof(*m_measuring_affinity), &*m_measuring_affinity) < 0) {
+            perror("sched_setaffinity");
+        }
+        m_measuring_affinity.reset();
     }
-    assert(m_virt_phys_mappings.size() == num_superpages);
 }
 
 uint8_t* memory::get_random_address() const {
     assert(m_ptr != nullptr && m_size > 0);
 
-    static std::random_device rd;
-    static std::default_random_engine generator(rd());
-    static std::uniform_int_distribution<size_t> distribution(0, m_size - 1);
+    auto num_ready = m_num_ready.load(std::memory_order_acquire);
+    assert(num_ready > 0);
+
+    std::uniform_int_distribution<size_t> superpage_distribution(0, num_ready - 1);
+    std::uniform_int_distribution<size_t> offset_distribution(0, SUPERPAGE - 1);
 
-    size_t offset = distribution(generator);
-    return m_ptr + offset;
+    auto superpage_idx = m_ready_superpages[superpage_distribution(m_generator)];
+    return m_virt_phys_mappings[superpage_idx].first + offset_distribution(m_generator);
 }
 
 uintptr_t memory::virt_to_phys(uint8_t* virt) const {
-    auto offset = (size_t)virt & SUPERPAGE_MASK;
-    auto virt_base = virt - offset;
-
-    // Determine phys_base by searching through m_virt_phys_mappings.
-    uintptr_t phys_base = -1;
-    for (auto& [superpage_virt, superpage_phys] : m_virt_phys_mappings) {
-        if (virt_base == superpage_virt) {
-            phys_base = superpage_phys;
-            break;
-        }
-    }
+    assert(virt >= m_ptr && virt < m_ptr + m_size);
+
+    // The superpages are contiguous in virtual memory, so the mapping can be looked up directly.
+    auto offset = (size_t)(virt - m_ptr);
+    auto phys_base = m_virt_phys_mappings[offset / SUPERPAGE].second;
     assert(phys_base != (uintptr_t)-1);
 
-    return phys_base + offset;
+    return phys_base + (offset & SUPERPAGE_MASK);
 }
 
 uint8_t* memory::phys_to_virt(uintptr_t phys) const {
     auto offset = (size_t)phys & SUPERPAGE_MASK;
     auto phys_base = phys - offset;
 
-    // Determine virt_base by searching through m_virt_phys_mappings.
+    // Determine virt_base by searching through the superpages that are already populated.
     auto virt_base = (uint8_t*)-1;
-    for (auto& [superpage_virt, superpage_phys] : m_virt_phys_mappings) {
+    auto num_ready = m_num_ready.load(std::memory_order_acquire);
+    for (size_t i = 0; i < num_ready; i++) {
+        auto& [superpage_virt, superpage_phys] = m_virt_phys_mappings[m_ready_superpages[i]];
         if (phys_base == superpage_phys) {
             virt_base = superpage_virt;
             break;
@@ -95,4 +195,13 @@ uint8_t* memory::phys_to_virt(uintptr_t phys) const {
     assert(virt_base != (uint8_t*)-1);
 
     return virt_base + offset;
+}
+
+std::vector<uintptr_t> memory::phys_superpages() const {
+    std::vector<uintptr_t> phys_bases;
+    auto num_ready = m_num_ready.load(std::memory_order_acquire);
+    for (size_t i = 0; i < num_ready; i++) {
+        phys_bases.push_back(m_virt_phys_mappings[m_ready_superpages[i]].second);
+    }
+    return phys_bases;
 }
\ No newline at end of file
@@ -1,5 +1,12 @@
+#include "sched.h"
+#include <atomic>
+#include <condition_variable>
 #include <cstdint>
 #include <cstdlib>
+#include <mutex>
+#include <optional>
+#include <random>
+#include <thread>
 #include <vector>
 
 #pragma once
@@ -9,18 +16,47 @@ public:
     memory() = default;
     ~memory();
 
-    void allocate(size_t num_superpages);
+    // Maps the superpages and starts populating them in the background. Returns
+    // as soon as the first superpage is ready to be used. If a NUMA node is
+    // given, the superpages are only allocated from that node. Until all
+    // superpages are populated, the calling thread is pinned to its current CPU,
+    // which the populating threads do not use.
+    void allocate(size_t num_superpages, std::optional<size_t> numa_node = {});
+    // Blocks until all superpages are populated, locked and translated. Must be
+    // called on the thread that called allocate(), whose affinity is restored.
+    void wait_until_populated();
 
+    // Returns a random address from one of the superpages that are already populated.
     [[nodiscard]] uint8_t* get_random_address() const;
 
     [[nodiscard]] uintptr_t virt_to_phys(uint8_t*) const;
     [[nodiscard]] uint8_t* phys_to_virt(uintptr_t) const;
+    // Physical base addresses of all superpages that are already populated.
+    [[nodiscard]] std::vector<uintptr_t> phys_superpages() const;
 
     [[nodiscard]] uint8_t* ptr() const { return m_ptr; }
     [[nodiscard]] size_t size() const { return m_size; }
 
 private:
+    void populate_superpages();
+    void restore_affinity();
+
     uint8_t* m_ptr { nullptr };
     size_t m_size { 0 };
+    // One entry per superpage, in virtual address order. The physical base is only valid once the superpage is listed
+    // in m_ready_superpages.
     std::vector<std::pair<uint8_t*, uintptr_t>> m_virt_phys_mappings;
+
+    // Indices of populated superpages, in the order in which they became ready. Only the first m_num_ready entries
+    // are valid.
+    std::vector<size_t> m_ready_superpages;
+    std::atomic<size_t> m_num_ready { 0 };
+    std::atomic<size_t> m_next_to_populate { 0 };
+    std::mutex m_ready_mutex;
+    std::condition_variable m_ready_cv;
+    std::vector<std::thread> m_populate_threads;
+    // Affinity of the thread that called allocate(), while it is pinned to its CPU.
+    std::optional<cpu_set_t> m_measuring_affinity;
+
+    mutable std::default_random_engine m_generator { std::random_device {}() };
 };
\ No newline at end of file
@@ -0,0 +1,109 @@
+#include "linux/mempolicy.h"
+#include "sched.h"
+#include "sys/syscall.h"
+#include "unistd.h"
+#include <array>
+#include <climits>
+#include <cstdio>
+#include <string>
+
+#include "numa.hpp"
+#include "utils.hpp"
+
+static constexpr char const* NODE_SYSFS_PATH = "/sys/devices/system/node";
+
+static std::optional<std::string> read_line(std::string const& path) {
+    FILE* fp = fopen(path.c_str(), "r");
+    if (!fp) {
+        return {};
+    }
+    std::array<char, 4096> line {};
+    auto* result = fgets(line.data(), line.size(), fp);
+    fclose(fp);
+    if (!result) {
+        return {};
+    }
+    return std::string(line.data());
+}
+
+// Parses the list format used by sysfs, e.g., "0-3,8-11".
+static std::vector<size_t> parse_list(std::string const& list) {
+    std::vector<size_t> values;
+    char const* str = list.c_str();
+    while (*str) {
+        char* end;
+        auto first = strtoul(str, &end, 10);
+        if (end == str) {
+            break;
+        }
+        auto last = first;
+        if (*end == '-') {
+            str = end + 1;
+            last = strtoul(str, &end, 10);
+        }
+        for (auto value = first; value <= last; value++) {
+            values.push_back(value);
+        }
+        str = *end == ',' ? end + 1 : end;
+    }
+    return values;
+}
+
+std::vector<size_t> numa::memory_nodes() {
+    auto nodes = read_line(std::string(NODE_SYSFS_PATH) + "/has_memory");
+    if (!nodes.has_value()) {
+        return {};
+    }
+    return parse_list(*nodes);
+}
+
+std::optional<size_t> numa::free_superpages(size_t node) {
+    auto free = read_line(std::string(NODE_SYSFS_PATH) + "/node" + std::to_string(node) + "/hugepages/hugepages-1048576kB/free_hugepages");
+    if (!free.has_value()) {
+        return {};
+    }
+    return std::stoul(*free);
+}
+
+bool numa::bind_memory(void* addr, size_t size, size_t node) {
+    constexpr size_t BITS_PER_WORD = sizeof(unsigned long) * CHAR_BIT;
+    std::array<unsigned long, 16> node_mask {};
+    if (node >= node_mask.size() * BITS_PER_WORD) {
+        LOG_ERROR("[numa] Node %zu is out of range.\n", node);
+        return false;
+    }
+    node_mask[node / BITS_PER_WORD] |= 1UL << (node % BITS_PER_WORD);
+
+    // The kernel expects the number of bits in the mask plus one.
+    if (syscall(SYS_mbind, addr, size, MPOL_BIND, node_mask.data(), node_mask.size() * BITS_PER_WORD + 1, 0) < 0) {
+        perror("mbind");
+        return false;
+    }
+    return true;
+}
+
+bool numa::run_on_node(size_t node) {
+    auto cpus = read_line(std::string(NODE_SYSFS_PATH) + "/node" + std::to_string(node) + "/cpulist");
+    if (!cpus.has_value()) {
+        LOG_ERROR("[numa] Could not read the CPUs of node %zu.\n", node);
+        return false;
+    }
+
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    for (auto cpu : parse_list(*cpus)) {
+        if (cpu < CPU_SETSIZE) {
+            CPU_SET(cpu, &cpu_set);
+        }
+    }
+    if (CPU_COUNT(&cpu_set) == 0) {
+        LOG_ERROR("[numa] Node %zu has no CPUs.\n", node);
+        return false;
+    }
+
+    if (sched_setaffinity(0, sizeof(cpu_set), &cpu_set) < 0) {
+        perror("sched_setaffinity");
+        return false;
+    }
+    return true;
+}
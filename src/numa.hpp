@@ -0,0 +1,20 @@
+#include <cstdint>
+#include <cstdlib>
+#include <optional>
+#include <vector>
+
+#pragma once
+
+// NUMA topology and policies, read from sysfs and set using system calls (so no libnuma is needed).
+class numa {
+public:
+    // Nodes that have memory, in ascending order. Empty if the kernel does not report any.
+    static std::vector<size_t> memory_nodes();
+    // Number of free 1 GiB superpages on the node, if the kernel reports it.
+    static std::optional<size_t> free_superpages(size_t node);
+
+    // Sets the memory policy of the (not yet populated) range so that it is only allocated from the node.
+    static bool bind_memory(void* addr, size_t size, size_t node);
+    // Restricts the calling thread (and threads it creates afterwards) to the CPUs of the node.
+    static bool run_on_node(size_t node);
+};
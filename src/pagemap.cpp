@@ -1,3 +1,5 @@
+#include "fcntl.h"
+#include "unistd.h"
 #include <cstdint>
 
 #include "pagemap.hpp"
@@ -7,30 +9,27 @@ constexpr size_t PAGE_OFFSET_BITS = 12;
 constexpr uintptr_t PAGE_OFFSET_MASK = (uintptr_t(1) << PAGE_OFFSET_BITS) - 1;
 constexpr uint64_t PFN_MASK = (uint64_t(1) << 55) - 1;
 
-static FILE* pagemap_fp;
+static int open_pagemap() {
+    int fd = open("/proc/self/pagemap", O_RDONLY);
+    if (fd < 0) {
+        perror("open (pagemap)");
+        exit(1);
+    }
+    return fd;
+}
 
 uintptr_t pagemap::virt_to_phys(void* virt_addr) {
     size_t vpn = (uintptr_t)virt_addr >> PAGE_OFFSET_BITS;
 
-    if (!pagemap_fp) {
-        pagemap_fp = fopen("/proc/self/pagemap", "rb");
-        if (!pagemap_fp) {
-            perror("fopen (pagemap)");
-            exit(1);
-        }
-    }
+    // Opened once and only accessed using pread(), so translations can be done from multiple threads concurrently.
+    static int pagemap_fd = open_pagemap();
 
     // There is 1 64-bit value for each VPN.
     size_t offset = vpn * sizeof(uint64_t);
 
-    if (fseek(pagemap_fp, offset, SEEK_SET) < 0) {
-        perror("fseek (pagemap)");
-        exit(1);
-    }
-
     uint64_t info;
-    if (fread(&info, sizeof(uint64_t), 1, pagemap_fp) < 1) {
-        perror("fread (pagemap)");
+    if (pread(pagemap_fd, &info, sizeof(uint64_t), (off_t)offset) != sizeof(uint64_t)) {
+        perror("pread (pagemap)");
         exit(1);
     }
 
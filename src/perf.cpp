@@ -0,0 +1,133 @@
+#include "linux/perf_event.h"
+#include "sys/ioctl.h"
+#include "sys/syscall.h"
+#include "unistd.h"
+#include <cerrno>
+#include <cstring>
+
+#include "perf.hpp"
+#include "utils.hpp"
+
+struct event_description {
+    char const* name;
+    uint32_t type;
+    uint64_t config;
+    // How much the counter may increase within a window before the window is considered disturbed.
+    uint64_t tolerance;
+};
+
+static constexpr std::array<event_description, perf_monitor::NUM_EVENTS> EVENTS { {
+    { "context switches", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES, 0 },
+    { "CPU migrations", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CPU_MIGRATIONS, 0 },
+    { "page faults", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS, 0 },
+    // The first access to each of the two addresses may legitimately require a page walk.
+    { "dTLB load misses", PERF_TYPE_HW_CACHE,
+        PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16), 2 },
+} };
+
+static int perf_event_open(perf_event_attr* attr, int group_fd) {
+    // Measure the calling thread on any CPU.
+    return (int)syscall(SYS_perf_event_open, attr, 0, -1, group_fd, 0);
+}
+
+// Layout of a read() of the group leader with PERF_FORMAT_GROUP | PERF_FORMAT_ID.
+struct group_read_format {
+    uint64_t nr;
+    struct {
+        uint64_t value;
+        uint64_t id;
+    } values[perf_monitor::NUM_EVENTS];
+};
+
+perf_monitor::perf_monitor() {
+    // All counters are in one group led by the first one, so that a snapshot is a single read().
+    m_fds.fill(-1);
+    for (size_t i = 0; i < NUM_EVENTS; i++) {
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = EVENTS[i].type;
+        attr.config = EVENTS[i].config;
+        attr.exclude_hv = 1;
+        // Only the accesses of the measurement itself should count, not those of the read() syscalls around it.
+        attr.exclude_kernel = EVENTS[i].type != PERF_TYPE_SOFTWARE;
+        attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_ID;
+
+        m_fds[i] = perf_event_open(&attr, i == 0 ? -1 : m_fds[0]);
+        if (m_fds[i] < 0) {
+            if (i == 0) {
+                break;
+            }
+            // Hardware counters are not available everywhere (e.g., in most VMs), so this is not fatal.
+            LOG_VERBOSE("[perf] Counter for %s not available (%s), ignoring it.\n", EVENTS[i].name, strerror(errno));
+            continue;
+        }
+        if (ioctl(m_fds[i], PERF_EVENT_IOC_ID, &m_ids[i]) < 0) {
+            perror("ioctl (perf_event)");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (m_fds[CONTEXT_SWITCHES] < 0) {
+        LOG_ERROR("[perf] Error: Could not open perf_event counters. Check /proc/sys/kernel/perf_event_paranoid.\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+perf_monitor::~perf_monitor() {
+    // Close the group members before the leader.
+    for (size_t i = NUM_EVENTS; i-- > 0;) {
+        if (m_fds[i] >= 0) {
+            close(m_fds[i]);
+        }
+    }
+}
+
+perf_monitor::snapshot perf_monitor::read() const {
+    group_read_format group;
+    if (::read(m_fds[0], &group, sizeof(group)) < (ssize_t)sizeof(uint64_t)) {
+        perror("read (perf_event)");
+        exit(EXIT_FAILURE);
+    }
+
+    snapshot values {};
+    for (size_t j = 0; j < group.nr && j < NUM_EVENTS; j++) {
+        for (size_t i = 0; i < NUM_EVENTS; i++) {
+            if (m_fds[i] >= 0 && m_ids[i] == group.values[j].id) {
+                values[i] = group.values[j].value;
+            }
+        }
+    }
+    return values;
+}
+
+bool perf_monitor::check_window(snapshot const& before, snapshot const& after) {
+    bool disturbed = false;
+    for (size_t i = 0; i < NUM_EVENTS; i++) {
+        if (after[i] - before[i] > EVENTS[i].tolerance) {
+            m_num_disturbed_by[i]++;
+            disturbed = true;
+        }
+    }
+
+    m_num_windows++;
+    m_num_disturbed += disturbed;
+    return disturbed;
+}
+
+void perf_monitor::print_stats() const {
+    if (m_num_windows == 0) {
+        return;
+    }
+
+    LOG("[perf] %zu of %zu measurement windows (%.2f%%) were disturbed, %zu measurements were repeated.\n",
+        m_num_disturbed, m_num_windows, 100.0 * (double)m_num_disturbed / (double)m_num_windows, m_num_remeasured);
+    for (size_t i = 0; i < NUM_EVENTS; i++) {
+        if (m_fds[i] < 0) {
+            LOG("    %-18s n/a\n", EVENTS[i].name);
+            continue;
+        }
+        LOG("    %-18s %zu windows (%.2f%%)\n", EVENTS[i].name, m_num_disturbed_by[i],
+            100.0 * (double)m_num_disturbed_by[i] / (double)m_num_windows);
+    }
+}
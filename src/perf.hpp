@@ -0,0 +1,44 @@
+#include <array>
+#include <cstdint>
+#include <cstdlib>
+
+#pragma once
+
+// Per-thread perf_event counters that are read around each measurement window to detect whether the measurement was
+// disturbed (e.g., by a context switch or a page fault). The counters only count events of the thread that created
+// the perf_monitor, so it has to be created by the measuring thread.
+class perf_monitor {
+public:
+    enum event : size_t {
+        CONTEXT_SWITCHES,
+        CPU_MIGRATIONS,
+        PAGE_FAULTS,
+        DTLB_LOAD_MISSES,
+        NUM_EVENTS
+    };
+
+    using snapshot = std::array<uint64_t, NUM_EVENTS>;
+
+    perf_monitor();
+    ~perf_monitor();
+
+    perf_monitor(perf_monitor const&) = delete;
+    perf_monitor& operator=(perf_monitor const&) = delete;
+
+    [[nodiscard]] snapshot read() const;
+
+    // Returns true if the window between the two snapshots was disturbed. Also updates the statistics.
+    bool check_window(snapshot const& before, snapshot const& after);
+    void count_remeasurement() { m_num_remeasured++; }
+
+    void print_stats() const;
+
+private:
+    std::array<int, NUM_EVENTS> m_fds {};
+    std::array<uint64_t, NUM_EVENTS> m_ids {};
+
+    size_t m_num_windows { 0 };
+    size_t m_num_disturbed { 0 };
+    size_t m_num_remeasured { 0 };
+    std::array<size_t, NUM_EVENTS> m_num_disturbed_by {};
+};
@@ -0,0 +1,102 @@
+#include <algorithm>
+
+#include "pipeline.hpp"
+#include "solver.hpp"
+
+pipelined_solver::pipelined_solver(size_t phys_dram_offset, size_t expected_num_clusters, size_t max_bits)
+    : m_phys_dram_offset(phys_dram_offset)
+    , m_expected_num_functions(msb_set(expected_num_clusters))
+    , m_max_bits(max_bits)
+    , m_worker(&pipelined_solver::run, this) {
+}
+
+pipelined_solver::~pipelined_solver() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_cancelled = true;
+    m_cv.notify_one();
+    m_worker.join();
+}
+
+void pipelined_solver::set_deadline(deadline_t deadline) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_deadline = deadline;
+}
+
+bool pipelined_solver::submit(std::vector<std::vector<uintptr_t>> clusters) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    // With fewer clusters than functions + 1, the clusters cannot tell all functions apart.
+    if (!m_stable && clusters.size() > m_expected_num_functions) {
+        m_pending = std::move(clusters);
+        m_cv.notify_one();
+    }
+    return m_stable;
+}
+
+std::optional<std::vector<func_t>> pipelined_solver::result() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!m_stable) {
+        return {};
+    }
+    return m_last_functions;
+}
+
+void pipelined_solver::run() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (true) {
+        m_cv.wait(lock, [this] { return m_stop || m_pending.has_value(); });
+        if (m_stop) {
+            return;
+        }
+
+        auto clusters = std::move(*m_pending);
+        m_pending.reset();
+        auto deadline = m_deadline;
+
+        lock.unlock();
+        auto functions = solve(clusters, deadline);
+        lock.lock();
+        if (!functions.has_value()) {
+            return;
+        }
+
+        if (functions->size() == m_expected_num_functions && *functions == m_last_functions) {
+            m_num_unchanged++;
+        } else {
+            m_num_unchanged = 0;
+        }
+        m_last_functions = std::move(*functions);
+        // The first snapshot with these functions counts, too.
+        if (m_num_unchanged + 1 >= PIPELINE_STABLE_SNAPSHOTS && m_last_functions.size() == m_expected_num_functions) {
+            m_stable = true;
+            return;
+        }
+    }
+}
+
+std::optional<std::vector<func_t>> pipelined_solver::solve(std::vector<std::vector<uintptr_t>> const& clusters, deadline_t deadline) {
+    solver snapshot(clusters, m_max_bits);
+    snapshot.set_deadline(deadline);
+    snapshot.set_stop_flag(&m_cancelled);
+    auto msb = snapshot.msb_considered(m_phys_dram_offset);
+
+    // New clusters are appended to the snapshot, but re-cleaning may change earlier ones, and addresses from more
+    // superpages may make more bits vary. Then the candidates have to be searched for again.
+    auto extends_previous = m_candidates.has_value() && msb == m_candidate_msb && clusters.size() >= m_candidate_clusters.size()
+        && std::equal(m_candidate_clusters.begin(), m_candidate_clusters.end(), clusters.begin());
+    if (!extends_previous) {
+        m_candidates = snapshot.find_constant_functions(m_phys_dram_offset);
+        if (!m_candidates.has_value()) {
+            return {};
+        }
+        m_candidate_msb = msb;
+    } else if (clusters.size() > m_candidate_clusters.size()) {
+        std::vector<std::vector<uintptr_t>> added(clusters.begin() + (ssize_t)m_candidate_clusters.size(), clusters.end());
+        m_candidates = solver(std::move(added), m_max_bits).filter_functions(*m_candidates, m_phys_dram_offset, feasibility::constant);
+    }
+    m_candidate_clusters = clusters;
+
+    return snapshot.filter_functions(*m_candidates, m_phys_dram_offset, feasibility::subset);
+}
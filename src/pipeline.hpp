@@ -0,0 +1,67 @@
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+#include "budget.hpp"
+#include "config.hpp"
+#include "function.hpp"
+
+#pragma once
+
+// Solves for the bank functions on a worker thread while the clusters are still being built. Snapshots of the
+// (cleaned) clusters built so far that arrive while the worker is busy replace each other, so the worker always
+// continues with the newest one. Only the first snapshot is brute-forced: the worker keeps the candidates that are
+// constant on every cluster solved for so far, and only checks those on the clusters added since. Of these candidates,
+// the functions are picked like solver::find_bank_functions_subset would. Once the functions are complete (one per
+// bit of the expected number of clusters) and have not changed over PIPELINE_STABLE_SNAPSHOTS consecutive snapshots,
+// the result is considered stable and building more clusters would not change it. Destroying the pipelined solver
+// stops a search that is still running.
+class pipelined_solver {
+public:
+    pipelined_solver(size_t phys_dram_offset, size_t expected_num_clusters, size_t max_bits = BRUTE_FORCE_MAX_BITS);
+    ~pipelined_solver();
+
+    pipelined_solver(pipelined_solver const&) = delete;
+    pipelined_solver& operator=(pipelined_solver const&) = delete;
+
+    // Searches that would not finish before the deadline (e.g., the end of building the clusters) are not started, and
+    // a running one is stopped once it passes.
+    void set_deadline(deadline_t deadline);
+
+    // Hands a new snapshot to the worker. Returns true if the result is already stable.
+    bool submit(std::vector<std::vector<uintptr_t>> clusters);
+
+    // The stable functions, if any.
+    [[nodiscard]] std::optional<std::vector<func_t>> result() const;
+
+private:
+    void run();
+    // Returns nothing if the search was stopped.
+    [[nodiscard]] std::optional<std::vector<func_t>> solve(std::vector<std::vector<uintptr_t>> const& clusters, deadline_t deadline);
+
+    size_t m_phys_dram_offset;
+    size_t m_expected_num_functions;
+    size_t m_max_bits;
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_cv;
+    std::optional<std::vector<std::vector<uintptr_t>>> m_pending;
+    bool m_stop { false };
+    deadline_t m_deadline;
+    std::atomic<bool> m_cancelled { false };
+
+    // Only used by the worker: the candidates constant on all clusters solved for so far, and those clusters.
+    std::optional<std::vector<func_t>> m_candidates;
+    std::vector<std::vector<uintptr_t>> m_candidate_clusters;
+    size_t m_candidate_msb { 0 };
+
+    std::vector<func_t> m_last_functions;
+    size_t m_num_unchanged { 0 };
+    bool m_stable { false };
+
+    std::thread m_worker;
+};
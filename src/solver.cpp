@@ -1,4 +1,8 @@
+#include <algorithm>
 #include <cassert>
+#include <chrono>
+#include <cmath>
+#include <optional>
 
 #include "solver.hpp"
 
@@ -19,7 +23,7 @@ static int apply_function_to_cluster(func_t func, std::vector<uintptr_t> const&
     return -1;
 }
 
-static bool function_is_feasible(func_t function, std::vector<std::vector<uintptr_t>> const& clusters) {
+static bool function_is_feasible(func_t function, std::vector<std::vector<uintptr_t>> const& clusters, feasibility mode) {
     // 1. Check if function is "constant enough" over all addresses in one cluster.
     auto first_cluster_result = apply_function_to_cluster(function, clusters.front());
     if (first_cluster_result < 0) {
@@ -40,6 +44,13 @@ static bool function_is_feasible(func_t function, std::vector<std::vector<uintpt
         clusters_with_result_one += result_for_cluster;
     }
 
+    if (mode == feasibility::constant) {
+        return true;
+    }
+    if (mode == feasibility::subset) {
+        return clusters_with_result_one != 0 && clusters_with_result_one != clusters.size();
+    }
+
     if (clusters_with_result_one * 2 == clusters.size()) {
         return true;
     }
@@ -47,12 +58,57 @@ static bool function_is_feasible(func_t function, std::vector<std::vector<uintpt
     if (clusters_with_result_one == 0 || clusters_with_result_one == clusters.size()) {
         // This is nothing special, just ignore it.
     } else {
-        LOG("[solver] %zu of %zu clusters had result 1 (function 0x%010lx)\n", clusters_with_result_one, clusters.size(), function);
+        LOG_VERBOSE("[solver] %zu of %zu clusters had result 1 (function 0x%010lx)\n", clusters_with_result_one, clusters.size(), function);
     }
     return false;
 }
 
-std::vector<func_t> solver::find_bank_functions(size_t phys_dram_offset) const {
+// Scores a function using the likelihood of its outputs over all clusters. In every cluster, the function is either
+// constant (up to the expected noise rate) or it is not, in which case the cluster counts as an outlier.
+static std::optional<scored_func> score_function(func_t function, std::vector<std::vector<uintptr_t>> const& clusters, size_t max_outlier_clusters) {
+    static double const LOG_NOISE = std::log(SOLVER_NOISE_RATE);
+    static double const LOG_NO_NOISE = std::log(1 - SOLVER_NOISE_RATE);
+    static double const LOG_HALF = std::log(0.5);
+
+    scored_func result { function, 0, 0, 0 };
+    size_t clusters_with_result_one = 0;
+
+    for (auto const& cluster : clusters) {
+        size_t num_ones = 0;
+        for (auto addr : cluster) {
+            num_ones += func_apply(function, addr);
+        }
+        auto num_zeros = cluster.size() - num_ones;
+
+        // Log-likelihood ratio of "constant 0" or "constant 1" (whichever fits better) against "not constant", i.e.,
+        // every address independently 0 or 1.
+        auto log_likelihood_zero = (double)num_zeros * LOG_NO_NOISE + (double)num_ones * LOG_NOISE;
+        auto log_likelihood_one = (double)num_ones * LOG_NO_NOISE + (double)num_zeros * LOG_NOISE;
+        auto log_likelihood_ratio = std::max(log_likelihood_zero, log_likelihood_one) - (double)cluster.size() * LOG_HALF;
+        result.score += log_likelihood_ratio;
+
+        if (log_likelihood_ratio < 0) {
+            if (++result.outlier_clusters > max_outlier_clusters) {
+                return {};
+            }
+            continue;
+        }
+
+        clusters_with_result_one += log_likelihood_one > log_likelihood_zero;
+    }
+
+    // Half of the clusters should have result one. Every outlier (or misclustered) cluster may shift this by one.
+    auto clusters_with_result_zero = clusters.size() - result.outlier_clusters - clusters_with_result_one;
+    auto imbalance = (size_t)std::abs((ssize_t)clusters_with_result_one - (ssize_t)clusters_with_result_zero);
+    if (imbalance > 2 * max_outlier_clusters || clusters_with_result_one == 0 || clusters_with_result_zero == 0) {
+        return {};
+    }
+
+    // The confidence is set once all candidates are known.
+    return result;
+}
+
+std::vector<std::vector<uintptr_t>> solver::clusters_with_offset(size_t phys_dram_offset) const {
     // Create copy of clusters that takes offset into account.
     std::vector<std::vector<uintptr_t>> clusters_with_offset;
     for (auto const& cluster : m_clusters_phys) {
@@ -62,7 +118,10 @@ std::vector<func_t> solver::find_bank_functions(size_t phys_dram_offset) const {
             clusters_with_offset.back().push_back(addr - phys_dram_offset);
         }
     }
+    return clusters_with_offset;
+}
 
+size_t solver::find_msb_considered(std::vector<std::vector<uintptr_t>> const& clusters_with_offset) {
     // Find MSB that is non-constant over all addresses.
     size_t msb_considered = SUPERPAGE_SHIFT;
     while (msb_considered < 8 * sizeof(void*) - 1) {
@@ -87,45 +146,235 @@ std::vector<func_t> solver::find_bank_functions(size_t phys_dram_offset) const {
         }
         msb_considered++;
     }
+    return msb_considered;
+}
+
+// Tracks how fast candidates are tested, to only start on the functions with the next number of bits if they can be
+// done before the deadline, and to stop right away once the deadline has passed.
+class deadline_tracker {
+public:
+    deadline_tracker(deadline_t deadline, std::atomic<bool> const* stop, size_t msb_considered, size_t lsb_considered)
+        : m_deadline(deadline)
+        , m_stop(stop)
+        , m_num_bits_considered(msb_considered - lsb_considered + 1) {
+    }
+
+    [[nodiscard]] bool level_fits(size_t num_bits) const {
+        if (stopped()) {
+            return false;
+        }
+        if (!m_deadline.has_value() || m_num_tested == 0) {
+            return !deadline_passed(m_deadline);
+        }
+        double num_candidates = 1;
+        for (size_t i = 0; i < num_bits; i++) {
+            num_candidates = num_candidates * (double)(m_num_bits_considered - i) / (double)(i + 1);
+        }
+        auto now = std::chrono::steady_clock::now();
+        auto seconds_per_candidate = std::chrono::duration<double>(now - m_start).count() / (double)m_num_tested;
+        return now + std::chrono::duration<double>(num_candidates * seconds_per_candidate) < *m_deadline;
+    }
+
+    // Only looks at the clock every so often, so it is cheap to call for every candidate.
+    bool passed() {
+        if (m_passed) {
+            return true;
+        }
+        m_passed = stopped() || (m_deadline.has_value() && (++m_num_tested & 0xffff) == 0 && deadline_passed(m_deadline));
+        return m_passed;
+    }
+    [[nodiscard]] bool has_passed() const { return m_passed; }
+
+private:
+    [[nodiscard]] bool stopped() const { return m_stop && m_stop->load(std::memory_order_relaxed); }
+
+    deadline_t m_deadline;
+    std::atomic<bool> const* m_stop;
+    size_t m_num_bits_considered;
+    std::chrono::steady_clock::time_point m_start { std::chrono::steady_clock::now() };
+    size_t m_num_tested { 0 };
+    bool m_passed { false };
+};
+
+// Adds the candidate to the functions if it is feasible (and, unless all constant functions are wanted, linearly
+// independent of the functions found so far).
+static void add_if_feasible(std::vector<func_t>& functions, func_t candidate, std::vector<std::vector<uintptr_t>> const& clusters, feasibility mode) {
+    if (!function_is_feasible(candidate, clusters, mode)) {
+        return;
+    }
+    functions.push_back(candidate);
+
+    // Check the functions are still linearly independent.
+    if (mode != feasibility::constant && !func_are_linearly_independent(functions)) {
+        functions.pop_back();
+    }
+}
+
+std::vector<func_t> solver::brute_force(std::vector<std::vector<uintptr_t>> const& clusters_with_offset, feasibility mode, size_t& max_bits_searched) const {
+    auto msb_considered = find_msb_considered(clusters_with_offset);
     auto lsb_considered = BRUTE_FORCE_LSB;
-    LOG_VERBOSE("Considering only functions with bits in range [%zu, %zu].\n", lsb_considered, msb_considered);
+    deadline_tracker deadline(m_deadline, m_stop, msb_considered, lsb_considered);
 
     std::vector<func_t> functions;
-    for (size_t num_bits = 1; num_bits <= BRUTE_FORCE_MAX_BITS; num_bits++) {
+    max_bits_searched = 0;
+    for (size_t num_bits = 1; num_bits <= m_max_bits && deadline.level_fits(num_bits); num_bits++) {
         auto candidate = func_first_permutation(num_bits, msb_considered, lsb_considered);
         auto last_candidate = func_last_permutation(num_bits, msb_considered, lsb_considered);
 
-        LOG_VERBOSE("[solve] Brute-forcing functions with %zu bits...\n", num_bits);
+        while (!deadline.passed()) {
+            add_if_feasible(functions, candidate, clusters_with_offset, mode);
+            if (candidate == last_candidate) {
+                break;
+            }
+            candidate = func_next_permutation(candidate);
+        }
+        if (deadline.has_passed()) {
+            break;
+        }
+        max_bits_searched = num_bits;
+    }
+    return functions;
+}
+
+std::vector<func_t> solver::find_bank_functions(size_t phys_dram_offset) const {
+    auto clusters_with_offset = this->clusters_with_offset(phys_dram_offset);
+    LOG_VERBOSE("Considering only functions with bits in range [%zu, %zu].\n", BRUTE_FORCE_LSB, find_msb_considered(clusters_with_offset));
+    LOG_VERBOSE("[solve] Brute-forcing functions with up to %zu bits...\n", m_max_bits);
 
-        while (true) {
-            if (function_is_feasible(candidate, clusters_with_offset)) {
-                functions.push_back(candidate);
+    return brute_force(clusters_with_offset, feasibility::balanced, m_max_bits_searched);
+}
 
-                // Check the functions are still linearly independent.
-                if (!func_are_linearly_independent(functions)) {
-                    functions.pop_back();
-                }
+void solver::print_functions(std::vector<func_t> const& functions) const {
+    if (m_max_bits_searched < m_max_bits) {
+        LOG("[solver] Out of time, only searched functions with up to %zu bits.\n", m_max_bits_searched);
+    }
+    printf("Found %zu functions (up to %zu bits):\n", functions.size(), m_max_bits_searched);
+    func_print_all(functions);
+}
+
+std::vector<func_t> solver::find_bank_functions_subset(size_t phys_dram_offset) const {
+    size_t max_bits_searched;
+    auto functions = brute_force(clusters_with_offset(phys_dram_offset), feasibility::subset, max_bits_searched);
+    if (max_bits_searched < m_max_bits) {
+        LOG("[solver] Out of time, only searched functions with up to %zu bits.\n", max_bits_searched);
+    }
+    return functions;
+}
+
+std::vector<scored_func> solver::find_bank_functions_scored(size_t phys_dram_offset, size_t max_outlier_clusters) const {
+    auto clusters_with_offset = this->clusters_with_offset(phys_dram_offset);
+    auto msb_considered = find_msb_considered(clusters_with_offset);
+    auto lsb_considered = BRUTE_FORCE_LSB;
+    LOG_VERBOSE("Considering only functions with bits in range [%zu, %zu].\n", lsb_considered, msb_considered);
+
+    deadline_tracker deadline(m_deadline, m_stop, msb_considered, lsb_considered);
+    m_max_bits_searched = 0;
+    m_max_outlier_clusters = max_outlier_clusters;
+
+    std::vector<scored_func> candidates;
+    for (size_t num_bits = 1; num_bits <= m_max_bits && deadline.level_fits(num_bits); num_bits++) {
+        auto candidate = func_first_permutation(num_bits, msb_considered, lsb_considered);
+        auto last_candidate = func_last_permutation(num_bits, msb_considered, lsb_considered);
+
+        LOG_VERBOSE("[solve] Scoring functions with %zu bits...\n", num_bits);
+
+        while (!deadline.passed()) {
+            if (auto scored = score_function(candidate, clusters_with_offset, max_outlier_clusters)) {
+                candidates.push_back(*scored);
             }
             if (candidate == last_candidate) {
                 break;
             }
             candidate = func_next_permutation(candidate);
         }
+        if (deadline.has_passed()) {
+            break;
+        }
+        m_max_bits_searched = num_bits;
     }
+    m_num_candidates = candidates.size();
+
+    // Rank the candidates: functions that fit all clusters first, then (as in the strict mode) fewer bits, then higher
+    // likelihood. Linear combinations of correct functions are just as likely, so the number of bits decides between
+    // those.
+    std::sort(candidates.begin(), candidates.end(), [](scored_func const& a, scored_func const& b) {
+        auto a_bits = __builtin_popcountll(a.func);
+        auto b_bits = __builtin_popcountll(b.func);
+        if (a.outlier_clusters != b.outlier_clusters) {
+            return a.outlier_clusters < b.outlier_clusters;
+        }
+        if (a_bits != b_bits) {
+            return a_bits < b_bits;
+        }
+        return a.score > b.score;
+    });
 
-    printf("Found %zu functions (up to %zu bits):\n", functions.size(), BRUTE_FORCE_MAX_BITS);
+    // n functions select one of 2^n clusters, so there cannot be more functions than that.
+    auto max_functions = msb_set(clusters_with_offset.size());
+    std::vector<scored_func> functions;
+    std::vector<func_t> basis;
+    for (auto const& candidate : candidates) {
+        if (functions.size() == max_functions) {
+            break;
+        }
+        basis.push_back(candidate.func);
+        if (func_are_linearly_independent(basis)) {
+            functions.push_back(candidate);
+        } else {
+            basis.pop_back();
+        }
+    }
 
-    if (!functions.empty()) {
-        func_t all_xored = 0;
-        for (auto func : functions) {
-            all_xored ^= func;
-            func_print(func);
+    // The remaining candidates outside the span of the functions found contradict the result. The closer the best of
+    // them comes to the score of a function, the less that function stands out from what the noise can produce.
+    // Without such a competitor, a function is compared to "random", which has a score of 0.
+    double competitor_score = 0;
+    for (auto const& candidate : candidates) {
+        if (candidate.score <= competitor_score) {
+            continue;
+        }
+        basis.push_back(candidate.func);
+        if (func_are_linearly_independent(basis)) {
+            competitor_score = candidate.score;
         }
+        basis.pop_back();
+    }
+    for (auto& function : functions) {
+        auto margin = std::clamp((function.score - competitor_score) / function.score, 0.0, 1.0);
+        function.confidence = margin * (double)(clusters_with_offset.size() - function.outlier_clusters) / (double)clusters_with_offset.size();
+    }
+
+    return functions;
+}
+
+void solver::print_scored_functions(std::vector<scored_func> const& functions) const {
+    if (m_max_bits_searched < m_max_bits) {
+        LOG("[solver] Out of time, only searched functions with up to %zu bits.\n", m_max_bits_searched);
+    }
+    printf("Found %zu functions (up to %zu bits, %zu candidates, at most %zu outlier clusters):\n", functions.size(),
+        m_max_bits_searched, m_num_candidates, m_max_outlier_clusters);
+    for (auto const& function : functions) {
+        printf("confidence %5.1f%%, %zu outlier clusters, log-likelihood ratio %8.1f: ", 100 * function.confidence,
+            function.outlier_clusters, function.score);
+        func_print(function.func);
+    }
+}
 
-        printf("XOR of all found functions:\n");
-        func_print(all_xored);
+std::optional<std::vector<func_t>> solver::find_constant_functions(size_t phys_dram_offset) const {
+    size_t max_bits_searched;
+    auto functions = brute_force(clusters_with_offset(phys_dram_offset), feasibility::constant, max_bits_searched);
+    if (max_bits_searched < m_max_bits) {
+        return {};
     }
+    return functions;
+}
 
+std::vector<func_t> solver::filter_functions(std::vector<func_t> const& candidates, size_t phys_dram_offset, feasibility mode) const {
+    auto clusters_with_offset = this->clusters_with_offset(phys_dram_offset);
+    std::vector<func_t> functions;
+    for (auto candidate : candidates) {
+        add_if_feasible(functions, candidate, clusters_with_offset, mode);
+    }
     return functions;
 }
 
@@ -138,6 +387,7 @@ void solver::find_bank_functions_automatic() const {
     for (size_t phys_dram_offset = 0; phys_dram_offset <= PHYS_DRAM_OFFSET_MAX; phys_dram_offset += PHYS_DRAM_OFFSET_STEP) {
         LOG("[solver] Solving for bank functions with phys_dram_offset = %zu MiB\n", phys_dram_offset / MiB);
         auto functions = find_bank_functions(phys_dram_offset);
+        print_functions(functions);
         LOG("[solver] Found %zu functions.\n", functions.size());
     }
 }
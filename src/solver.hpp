@@ -1,20 +1,81 @@
+#include "budget.hpp"
 #include "function.hpp"
+#include <atomic>
 #include <cstdint>
 #include <cstdlib>
+#include <optional>
 #include <vector>
 
 #pragma once
 
+// Which candidates are accepted: all have to be "constant enough" on every cluster. With balanced, a function also has
+// to be 1 on exactly half of the clusters, as expected if all clusters are given. With subset (for a subset of the
+// clusters), it only must not be the same on all of them. With constant, nothing more is required.
+enum class feasibility { balanced, subset, constant };
+
+struct scored_func {
+    func_t func;
+    // Sum of the per-cluster log-likelihood ratios of "constant" against "random".
+    double score;
+    // Fraction of clusters the function is constant on, scaled by the relative margin of its score over the best
+    // candidate that contradicts the functions found.
+    double confidence;
+    size_t outlier_clusters;
+};
+
 class solver {
 public:
-    explicit solver(std::vector<std::vector<uintptr_t>> clusters)
-        : m_clusters_phys(std::move(clusters)) {
+    explicit solver(std::vector<std::vector<uintptr_t>> clusters, size_t max_bits = BRUTE_FORCE_MAX_BITS)
+        : m_clusters_phys(std::move(clusters))
+        , m_max_bits(max_bits) {
     }
 
+    // Replaces the clusters, e.g., after they have been merged.
+    void set_clusters(std::vector<std::vector<uintptr_t>> clusters) { m_clusters_phys = std::move(clusters); }
+
+    // With a deadline, functions with more bits are only searched for if that is predicted to be done in time. The
+    // functions found until the deadline passes are returned.
+    void set_deadline(deadline_t deadline) { m_deadline = deadline; }
+    // Like a passed deadline, but as soon as the flag is set (e.g., by another thread).
+    void set_stop_flag(std::atomic<bool> const* stop) { m_stop = stop; }
+
+    // The searches do not print their result, so that it can be printed later (e.g., together with the results of
+    // other nodes). The print functions print the result of the last search.
     [[nodiscard]] std::vector<func_t> find_bank_functions(size_t phys_dram_offset) const;
+    void print_functions(std::vector<func_t> const& functions) const;
+    // True unless the last search (find_bank_functions or find_bank_functions_scored) ran out of time.
+    [[nodiscard]] bool search_completed() const { return m_max_bits_searched == m_max_bits; }
+
+    // Like find_bank_functions, but for a subset of the clusters: a function does not have to be 1 on exactly half of
+    // the clusters, only on some of them. Does not print anything, so it can be used on a background thread.
+    [[nodiscard]] std::vector<func_t> find_bank_functions_subset(size_t phys_dram_offset) const;
+
+    // Like find_bank_functions, but scores every candidate by its likelihood over all clusters instead of using a hard
+    // cutoff, and tolerates up to max_outlier_clusters clusters the function is not constant on.
+    [[nodiscard]] std::vector<scored_func> find_bank_functions_scored(size_t phys_dram_offset, size_t max_outlier_clusters) const;
+    void print_scored_functions(std::vector<scored_func> const& functions) const;
 
     void find_bank_functions_automatic() const;
 
+    // Returns all candidates that are constant on every cluster, in the order they are searched, or nothing if the
+    // search did not finish. Adding clusters can only remove candidates from this set (see filter_functions).
+    [[nodiscard]] std::optional<std::vector<func_t>> find_constant_functions(size_t phys_dram_offset) const;
+    // Returns the feasible candidates (for balanced and subset, only those linearly independent of the ones before).
+    [[nodiscard]] std::vector<func_t> filter_functions(std::vector<func_t> const& candidates, size_t phys_dram_offset, feasibility mode) const;
+    // Highest bit of the candidates; it depends on which bits differ between the addresses in the clusters.
+    [[nodiscard]] size_t msb_considered(size_t phys_dram_offset) const { return find_msb_considered(clusters_with_offset(phys_dram_offset)); }
+
 private:
+    [[nodiscard]] std::vector<func_t> brute_force(std::vector<std::vector<uintptr_t>> const& clusters_with_offset, feasibility mode, size_t& max_bits_searched) const;
+    [[nodiscard]] std::vector<std::vector<uintptr_t>> clusters_with_offset(size_t phys_dram_offset) const;
+    [[nodiscard]] static size_t find_msb_considered(std::vector<std::vector<uintptr_t>> const& clusters_with_offset);
+
     std::vector<std::vector<uintptr_t>> m_clusters_phys;
+    size_t m_max_bits;
+    deadline_t m_deadline;
+    std::atomic<bool> const* m_stop { nullptr };
+    // Statistics of the last search, for printing its result.
+    mutable size_t m_max_bits_searched { 0 };
+    mutable size_t m_num_candidates { 0 };
+    mutable size_t m_max_outlier_clusters { 0 };
 };
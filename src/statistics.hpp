@@ -0,0 +1,70 @@
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#pragma once
+
+template <typename T>
+static T median(std::vector<T> values) {
+    assert(!values.empty());
+    std::nth_element(values.begin(), values.begin() + values.size() / 2, values.end());
+    return values[values.size() / 2];
+}
+
+// Standard error of the median of the values, estimated from their median absolute deviation (i.e., assuming the bulk
+// of them is normally distributed, while ignoring outliers). The values are whole cycles, so their spread is at least
+// one cycle.
+template <typename T>
+static double median_standard_error(std::vector<T> const& values) {
+    auto center = (double)median(values);
+    std::vector<double> deviations;
+    for (auto value : values) {
+        deviations.push_back(std::abs((double)value - center));
+    }
+    auto sigma = 1.4826 * std::max(median(deviations), 1.0);
+    return 1.2533 * sigma / std::sqrt((double)values.size());
+}
+
+// Minimum error thresholding (Kittler and Illingworth, 1986) on sorted samples: models the samples below and above the
+// threshold as two normal distributions and picks the threshold that minimizes the classification error. Unlike
+// Otsu's method, this also works if one class (the row conflicts) is much smaller than the other.
+[[maybe_unused]] static size_t minimum_error_threshold_index(std::vector<uint64_t> const& samples) {
+    auto n = samples.size();
+    std::vector<double> prefix_sum(n + 1, 0);
+    std::vector<double> prefix_sum_squares(n + 1, 0);
+    for (size_t i = 0; i < n; i++) {
+        prefix_sum[i + 1] = prefix_sum[i] + (double)samples[i];
+        prefix_sum_squares[i + 1] = prefix_sum_squares[i] + (double)samples[i] * (double)samples[i];
+    }
+
+    // Both classes need a minimum size for their variance to be meaningful.
+    auto min_class_size = std::max<size_t>(n / 1024, 2);
+    auto best_index = n / 2;
+    auto best_criterion = std::numeric_limits<double>::max();
+    for (size_t i = min_class_size; i + min_class_size <= n; i++) {
+        // Only split between different values.
+        if (samples[i] == samples[i - 1]) {
+            continue;
+        }
+        auto n_low = (double)i;
+        auto n_high = (double)(n - i);
+        auto mean_low = prefix_sum[i] / n_low;
+        auto mean_high = (prefix_sum[n] - prefix_sum[i]) / n_high;
+        auto var_low = prefix_sum_squares[i] / n_low - mean_low * mean_low;
+        auto var_high = (prefix_sum_squares[n] - prefix_sum_squares[i]) / n_high - mean_high * mean_high;
+        if (var_low <= 0 || var_high <= 0) {
+            continue;
+        }
+        auto p_low = n_low / (double)n;
+        auto p_high = n_high / (double)n;
+        auto criterion = p_low * std::log(var_low) + p_high * std::log(var_high) - 2 * (p_low * std::log(p_low) + p_high * std::log(p_high));
+        if (criterion < best_criterion) {
+            best_criterion = criterion;
+            best_index = i;
+        }
+    }
+    return best_index;
+}
@@ -0,0 +1,98 @@
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <limits>
+
+#include "synthetic.hpp"
+
+// Fake virtual base address of the simulated allocation. Never dereferenced.
+static uint8_t* const VIRT_BASE = (uint8_t*)(uintptr_t(1) << 44);
+
+synthetic_timing_source::synthetic_timing_source(std::vector<func_t> functions, synthetic_timing_params const& params)
+    : m_functions(std::move(functions))
+    , m_params(params)
+    , m_generator(params.seed) {
+    assert(params.num_superpages <= params.phys_size / SUPERPAGE);
+
+    // Pick distinct random physical superpages, like the kernel would.
+    std::vector<uintptr_t> all_bases;
+    for (uintptr_t base = 0; base < params.phys_size; base += SUPERPAGE) {
+        all_bases.push_back(base);
+    }
+    std::shuffle(all_bases.begin(), all_bases.end(), m_generator);
+    m_phys_bases.assign(all_bases.begin(), all_bases.begin() + (ssize_t)params.num_superpages);
+}
+
+uint8_t* synthetic_timing_source::get_random_address() const {
+    std::uniform_int_distribution<size_t> distribution(0, m_params.num_superpages * SUPERPAGE - 1);
+    return VIRT_BASE + distribution(m_generator);
+}
+
+uintptr_t synthetic_timing_source::virt_to_phys(uint8_t* virt) const {
+    auto offset = (size_t)(virt - VIRT_BASE);
+    assert(offset < m_params.num_superpages * SUPERPAGE);
+    return m_phys_bases[offset / SUPERPAGE] + (offset & SUPERPAGE_MASK);
+}
+
+uint8_t* synthetic_timing_source::phys_to_virt(uintptr_t phys) const {
+    auto it = std::find(m_phys_bases.begin(), m_phys_bases.end(), phys & ~SUPERPAGE_MASK);
+    assert(it != m_phys_bases.end());
+    return VIRT_BASE + (it - m_phys_bases.begin()) * SUPERPAGE + (phys & SUPERPAGE_MASK);
+}
+
+uint64_t synthetic_timing_source::time(uint8_t* first, uint8_t* second, size_t iterations, size_t accesses_per_iter) const {
+    auto first_phys = virt_to_phys(first);
+    auto second_phys = virt_to_phys(second);
+    bool same_bank = func_apply_all(m_functions, first_phys) == func_apply_all(m_functions, second_phys);
+    bool same_row = (first_phys >> m_params.row_shift) == (second_phys >> m_params.row_shift);
+    auto latency = (same_bank && !same_row) ? m_params.conflict_cycles : m_params.no_conflict_cycles;
+
+    // Instead of simulating every access, draw the average over all accesses of an iteration directly.
+    auto n = (double)accesses_per_iter;
+    std::normal_distribution<double> noise(0, m_params.access_noise_cycles / std::sqrt(n));
+    std::binomial_distribution<size_t> spikes(accesses_per_iter, m_params.spike_probability);
+    std::bernoulli_distribution disturbed(m_params.disturbance_probability);
+
+    auto min_cycles = std::numeric_limits<double>::max();
+    for (size_t i = 0; i < iterations; i++) {
+        auto cycles = std::max(0.0, latency + noise(m_generator));
+        cycles += (double)spikes(m_generator) * m_params.spike_cycles / n;
+        if (disturbed(m_generator)) {
+            cycles += m_params.disturbance_cycles / n;
+        }
+        min_cycles = std::min(min_cycles, cycles);
+        m_simulated_cycles += cycles * n + m_params.iteration_overhead_cycles;
+    }
+
+    m_num_measurements++;
+    return (uint64_t)min_cycles;
+}
+
+uint64_t synthetic_timing_source::time_concurrent(std::vector<uint8_t*> const& addrs, size_t iterations) const {
+    m_num_measurements++;
+    if (addrs.empty()) {
+        return 0;
+    }
+
+    // The busiest channel determines how long it takes until all accesses are done.
+    std::vector<size_t> accesses_per_channel(BIT(m_params.num_channel_functions), 0);
+    for (auto* addr : addrs) {
+        auto phys = virt_to_phys(addr);
+        size_t channel = 0;
+        for (size_t i = 0; i < m_params.num_channel_functions; i++) {
+            channel |= (size_t)func_apply(m_functions[i], phys) << i;
+        }
+        accesses_per_channel[channel]++;
+    }
+    auto max_accesses = *std::max_element(accesses_per_channel.begin(), accesses_per_channel.end());
+    auto latency = m_params.no_conflict_cycles + (double)max_accesses * m_params.channel_access_cycles;
+
+    std::normal_distribution<double> noise(0, m_params.access_noise_cycles);
+    auto min_cycles = std::numeric_limits<double>::max();
+    for (size_t i = 0; i < iterations; i++) {
+        auto cycles = std::max(0.0, latency + noise(m_generator));
+        min_cycles = std::min(min_cycles, cycles);
+        m_simulated_cycles += cycles + m_params.iteration_overhead_cycles;
+    }
+    return (uint64_t)min_cycles;
+}
@@ -0,0 +1,60 @@
+#include <random>
+
+#include "function.hpp"
+#include "timing.hpp"
+
+#pragma once
+
+// Parameters of the simulated DRAM. The defaults roughly resemble the latency histogram of a desktop system.
+struct synthetic_timing_params {
+    uint64_t seed { 0 };
+    size_t num_superpages { 4 };
+    // The superpages are placed at random (superpage-aligned) physical addresses below this.
+    size_t phys_size { 64 * GiB };
+    // Addresses in the same bank and the same row do not conflict.
+    size_t row_shift { 18 };
+    double no_conflict_cycles { 330 };
+    double conflict_cycles { 420 };
+    // Standard deviation of the latency of a single access.
+    double access_noise_cycles { 60 };
+    // Probability and cost of a single access being delayed (e.g., by a refresh).
+    double spike_probability { 0.01 };
+    double spike_cycles { 1000 };
+    // Probability and cost of an entire iteration being disturbed (e.g., by an interrupt).
+    double disturbance_probability { 0.02 };
+    double disturbance_cycles { 5000 };
+    // Cost of the serializing instructions around each iteration.
+    double iteration_overhead_cycles { 200 };
+    // The first this many functions select the channel. Concurrent accesses to the same channel are served one after
+    // another, accesses to different channels overlap.
+    size_t num_channel_functions { 0 };
+    double channel_access_cycles { 10 };
+};
+
+// Simulates access times for a DRAM with a known bank mapping, so the analysis can be run (and benchmarked) without
+// the actual hardware. The returned virtual addresses must not be dereferenced.
+class synthetic_timing_source : public timing_source {
+public:
+    synthetic_timing_source(std::vector<func_t> functions, synthetic_timing_params const& params);
+
+    [[nodiscard]] uint8_t* get_random_address() const override;
+    [[nodiscard]] uintptr_t virt_to_phys(uint8_t* virt) const override;
+    [[nodiscard]] uint8_t* phys_to_virt(uintptr_t phys) const override;
+    [[nodiscard]] std::vector<uintptr_t> phys_superpages() const override { return m_phys_bases; }
+
+    [[nodiscard]] uint64_t time(uint8_t* first, uint8_t* second, size_t iterations, size_t accesses_per_iter) const override;
+    [[nodiscard]] uint64_t time_concurrent(std::vector<uint8_t*> const& addrs, size_t iterations) const override;
+
+    [[nodiscard]] size_t num_measurements() const { return m_num_measurements; }
+    // Cycles the measurements would have taken on the simulated system.
+    [[nodiscard]] double simulated_cycles() const { return m_simulated_cycles; }
+
+private:
+    std::vector<func_t> m_functions;
+    synthetic_timing_params m_params;
+    std::vector<uintptr_t> m_phys_bases;
+
+    mutable std::mt19937_64 m_generator;
+    mutable size_t m_num_measurements { 0 };
+    mutable double m_simulated_cycles { 0 };
+};
@@ -0,0 +1,310 @@
+#include "cpuid.h"
+#include "x86intrin.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <limits>
+#include <thread>
+
+#include "assembly.hpp"
+#include "config.hpp"
+#include "statistics.hpp"
+#include "timing.hpp"
+#include "utils.hpp"
+
+// How the measured accesses are separated from the surrounding code, and how the time is read.
+enum class kernel_serialization {
+    // CPUID + RDTSC before, RDTSCP + CPUID after. Expensive if CPUID traps (e.g., under virtualization).
+    cpuid,
+    // MFENCE + LFENCE + RDTSC before, RDTSCP + LFENCE after.
+    lfence,
+    // LFENCE + RDPRU (APERF) + LFENCE before and after. Counts core cycles instead of TSC cycles.
+    rdpru,
+};
+
+enum class kernel_flush {
+    clflush,
+    // Weakly ordered, but the flushes are followed by an MFENCE anyway.
+    clflushopt,
+};
+
+struct timing_kernel {
+    char const* name;
+    kernel_serialization serialization;
+    kernel_flush flush;
+    uint64_t (*time)(uint8_t* first, uint8_t* second, size_t iterations, size_t accesses_per_iter);
+};
+
+template <kernel_serialization S>
+static inline uint64_t kernel_start() {
+    if constexpr (S == kernel_serialization::cpuid) {
+        assembly::cpuid();
+        auto start = assembly::rdtsc();
+        _mm_lfence();
+        return start;
+    } else if constexpr (S == kernel_serialization::lfence) {
+        _mm_mfence();
+        _mm_lfence();
+        auto start = assembly::rdtsc();
+        _mm_lfence();
+        return start;
+    } else {
+        _mm_lfence();
+        auto start = assembly::rdpru_aperf();
+        _mm_lfence();
+        return start;
+    }
+}
+
+template <kernel_serialization S>
+static inline uint64_t kernel_stop() {
+    if constexpr (S == kernel_serialization::cpuid) {
+        auto stop = assembly::rdtscp();
+        assembly::cpuid();
+        return stop;
+    } else if constexpr (S == kernel_serialization::lfence) {
+        auto stop = assembly::rdtscp();
+        _mm_lfence();
+        return stop;
+    } else {
+        _mm_lfence();
+        auto stop = assembly::rdpru_aperf();
+        _mm_lfence();
+        return stop;
+    }
+}
+
+template <kernel_flush F>
+static inline void kernel_flush_line(volatile uint8_t* addr) {
+    if constexpr (F == kernel_flush::clflush) {
+        _mm_clflush((void*)addr);
+    } else {
+        assembly::clflushopt(addr);
+    }
+}
+
+// Measurements as described in section 3.2.1 of the Intel "How to Benchmark
+// Code Execution Times" whitepaper:
+// https://www.intel.com/content/dam/www/public/us/en/documents/white-papers/ia-32-ia-64-benchmark-code-execution-paper.pdf
+template <kernel_serialization S, kernel_flush F>
+static uint64_t time_kernel(uint8_t* first, uint8_t* second, size_t iterations, size_t accesses_per_iter) {
+    auto* f = (volatile uint8_t*)first;
+    auto* s = (volatile uint8_t*)second;
+
+    uint64_t min_cycles = std::numeric_limits<uint64_t>::max();
+
+    for (size_t i = 0; i < iterations; i++) {
+        auto start = kernel_start<S>();
+
+        for (size_t j = 0; j < accesses_per_iter; j++) {
+            kernel_flush_line<F>(f);
+            kernel_flush_line<F>(s);
+            // clflush is only serialized by mfence, not lfence or sfence
+            _mm_mfence();
+
+            *f;
+            *s;
+        }
+
+        auto stop = kernel_stop<S>();
+
+        auto cycles = (stop - start) / accesses_per_iter;
+        if (cycles < min_cycles) {
+            min_cycles = cycles;
+        }
+    }
+
+    return min_cycles;
+}
+
+#define TIMING_KERNEL(serialization, flush)                                                  \
+    timing_kernel {                                                                          \
+        #serialization "-" #flush, kernel_serialization::serialization, kernel_flush::flush, \
+            &time_kernel<kernel_serialization::serialization, kernel_flush::flush>           \
+    }
+
+// The first kernel is the original measurement loop, which is used if the threshold is given on the command line.
+// Every access is flushed and fenced on its own (both addresses are accessed over and over), so unrolling the loop
+// would not change what is measured.
+static std::array<timing_kernel, 6> const KERNELS { {
+    TIMING_KERNEL(cpuid, clflush),
+    TIMING_KERNEL(cpuid, clflushopt),
+    TIMING_KERNEL(lfence, clflush),
+    TIMING_KERNEL(lfence, clflushopt),
+    TIMING_KERNEL(rdpru, clflush),
+    TIMING_KERNEL(rdpru, clflushopt),
+} };
+
+static bool kernel_supported(timing_kernel const& kernel) {
+    unsigned eax, ebx, ecx, edx;
+    if (kernel.flush == kernel_flush::clflushopt) {
+        if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) || !(ebx & BIT(23))) {
+            return false;
+        }
+    }
+    if (kernel.serialization == kernel_serialization::rdpru) {
+        if (!__get_cpuid(0x80000008, &eax, &ebx, &ecx, &edx) || !(ebx & BIT(4))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+hardware_timing_source::hardware_timing_source(size_t num_superpages, std::optional<size_t> numa_node, std::optional<std::string> const& kernel) {
+    m_memory.allocate(num_superpages, numa_node);
+
+    if (!kernel.has_value()) {
+        m_kernel = calibrate();
+        return;
+    }
+
+    auto it = std::find_if(KERNELS.begin(), KERNELS.end(), [&](timing_kernel const& k) { return k.name == *kernel; });
+    if (it == KERNELS.end()) {
+        LOG_ERROR("[timing] Error: Unknown kernel '%s'.\n", kernel->c_str());
+        exit(EXIT_FAILURE);
+    }
+    if (!kernel_supported(*it)) {
+        LOG_ERROR("[timing] Error: Kernel '%s' is not supported by this CPU.\n", it->name);
+        exit(EXIT_FAILURE);
+    }
+    m_kernel = &*it;
+    LOG_VERBOSE("[timing] Using kernel %s.\n", m_kernel->name);
+}
+
+std::vector<std::string> hardware_timing_source::kernel_names() {
+    std::vector<std::string> names;
+    for (auto const& kernel : KERNELS) {
+        names.emplace_back(kernel.name);
+    }
+    return names;
+}
+
+// Times the same random pairs with every supported kernel (interleaved, so that all kernels see the same conditions)
+// and rates each by how well it separates row conflicts from other pairs, relative to how long it takes. The
+// separation is the distance between the means of both classes (split using minimum error thresholding) in units of
+// their pooled standard deviation. As it grows with the square root of the number of accesses, its square is divided
+// by the cycles spent. The number of iterations and accesses is the same for all kernels, so a kernel that separates
+// worse than the original one (the first) is not used, even if it is much faster.
+timing_kernel const* hardware_timing_source::calibrate() const {
+    std::vector<timing_kernel const*> candidates;
+    for (auto const& kernel : KERNELS) {
+        if (kernel_supported(kernel)) {
+            candidates.push_back(&kernel);
+        }
+    }
+    LOG("[timing] Calibrating %zu measurement kernels using %zu address pairs...\n", candidates.size(), TIMING_CALIBRATION_PAIRS);
+
+    std::vector<std::vector<uint64_t>> samples(candidates.size());
+    std::vector<uint64_t> cost(candidates.size(), 0);
+    for (size_t i = 0; i < TIMING_CALIBRATION_PAIRS; i++) {
+        auto* first = m_memory.get_random_address();
+        auto* second = m_memory.get_random_address();
+        for (size_t k = 0; k < candidates.size(); k++) {
+            auto start = assembly::rdtsc();
+            samples[k].push_back(candidates[k]->time(first, second, DARE_ITERATIONS, DARE_ACCESSES_PER_ITER));
+            cost[k] += assembly::rdtsc() - start;
+        }
+    }
+
+    timing_kernel const* best_kernel = candidates.front();
+    double best_score = 0;
+    double min_separation = 0;
+    for (size_t k = 0; k < candidates.size(); k++) {
+        auto& kernel_samples = samples[k];
+        std::sort(kernel_samples.begin(), kernel_samples.end());
+        auto threshold_index = minimum_error_threshold_index(kernel_samples);
+
+        double n_low = (double)threshold_index;
+        double n_high = (double)(kernel_samples.size() - threshold_index);
+        double sum_low = 0, sum_high = 0, sum_squares_low = 0, sum_squares_high = 0;
+        for (size_t i = 0; i < kernel_samples.size(); i++) {
+            auto sample = (double)kernel_samples[i];
+            (i < threshold_index ? sum_low : sum_high) += sample;
+            (i < threshold_index ? sum_squares_low : sum_squares_high) += sample * sample;
+        }
+        auto mean_low = sum_low / n_low;
+        auto mean_high = sum_high / n_high;
+        auto pooled_variance = (sum_squares_low - n_low * mean_low * mean_low + sum_squares_high - n_high * mean_high * mean_high)
+            / (n_low + n_high);
+        auto separation = (mean_high - mean_low) / std::sqrt(std::max(pooled_variance, 1.0));
+        auto cycles_per_measurement = (double)cost[k] / TIMING_CALIBRATION_PAIRS;
+        auto score = separation * separation / cycles_per_measurement;
+
+        LOG_VERBOSE("[timing] %-22s %6.0f vs. %6.0f cycles, separation %5.1f, %8.0f cycles per measurement\n",
+            candidates[k]->name, mean_low, mean_high, separation, cycles_per_measurement);
+        if (k == 0) {
+            min_separation = separation;
+        }
+        if (separation >= min_separation && score > best_score) {
+            best_score = score;
+            best_kernel = candidates[k];
+        }
+    }
+
+    LOG("[timing] Using kernel %s.\n", best_kernel->name);
+    return best_kernel;
+}
+
+uint64_t hardware_timing_source::time(uint8_t* first, uint8_t* second, size_t iterations, size_t accesses_per_iter) const {
+    return m_kernel->time(first, second, iterations, accesses_per_iter);
+}
+
+// Loads all addresses at once from several threads, each with as many loads in flight as its core allows. A single
+// core is limited by its fill buffers long before the DRAM is, so only several cores together contend for the DRAM.
+// If the addresses are spread over independent parts of the DRAM (e.g., channels), this is faster than if they all
+// compete for the same part. The time of an iteration is from the first thread starting to the last one finishing.
+uint64_t hardware_timing_source::time_concurrent(std::vector<uint8_t*> const& addrs, size_t iterations) const {
+    auto num_threads = std::clamp<size_t>(std::thread::hardware_concurrency(), 1, CLASSIFY_CONTENTION_THREADS);
+    num_threads = std::min(num_threads, std::max<size_t>(addrs.size(), 1));
+    std::vector<uint64_t> starts(iterations * num_threads);
+    std::vector<uint64_t> stops(iterations * num_threads);
+    std::atomic<size_t> num_arrived { 0 };
+
+    auto run = [&](size_t thread) {
+        for (size_t i = 0; i < iterations; i++) {
+            for (size_t j = thread; j < addrs.size(); j += num_threads) {
+                _mm_clflush(addrs[j]);
+            }
+            _mm_mfence();
+
+            // Start all threads at (roughly) the same time.
+            num_arrived++;
+            while (num_arrived.load() < (i + 1) * num_threads) { }
+
+            assembly::cpuid();
+            auto start = assembly::rdtsc();
+            _mm_lfence();
+
+            for (size_t j = thread; j < addrs.size(); j += num_threads) {
+                *(volatile uint8_t*)addrs[j];
+            }
+
+            auto stop = assembly::rdtscp();
+            assembly::cpuid();
+
+            starts[i * num_threads + thread] = start;
+            stops[i * num_threads + thread] = stop;
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (size_t thread = 1; thread < num_threads; thread++) {
+        threads.emplace_back(run, thread);
+    }
+    run(0);
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    uint64_t min_cycles = std::numeric_limits<uint64_t>::max();
+    for (size_t i = 0; i < iterations; i++) {
+        auto first = starts.begin() + (ssize_t)(i * num_threads);
+        auto start = *std::min_element(first, first + (ssize_t)num_threads);
+        auto last = stops.begin() + (ssize_t)(i * num_threads);
+        auto stop = *std::max_element(last, last + (ssize_t)num_threads);
+        min_cycles = std::min(min_cycles, stop - start);
+    }
+
+    return min_cycles;
+}
@@ -0,0 +1,59 @@
+#include <cstdint>
+#include <cstdlib>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "memory.hpp"
+
+#pragma once
+
+// Where the analyzer gets its addresses and access times from.
+class timing_source {
+public:
+    virtual ~timing_source() = default;
+
+    [[nodiscard]] virtual uint8_t* get_random_address() const = 0;
+    [[nodiscard]] virtual uintptr_t virt_to_phys(uint8_t*) const = 0;
+    [[nodiscard]] virtual uint8_t* phys_to_virt(uintptr_t) const = 0;
+    // Physical base addresses of all superpages get_random_address() currently returns addresses from.
+    [[nodiscard]] virtual std::vector<uintptr_t> phys_superpages() const = 0;
+
+    // Blocks until all addresses can be returned by get_random_address().
+    virtual void wait_until_ready() { }
+
+    // Returns the number of cycles per access to both addresses (minimum over all iterations).
+    [[nodiscard]] virtual uint64_t time(uint8_t* first, uint8_t* second, size_t iterations, size_t accesses_per_iter) const = 0;
+    // Returns the number of cycles it takes to access all addresses at once (minimum over all iterations).
+    [[nodiscard]] virtual uint64_t time_concurrent(std::vector<uint8_t*> const& addrs, size_t iterations) const = 0;
+};
+
+// One variant of the measurement loop, see timing.cpp.
+struct timing_kernel;
+
+// Measures access times on the actual hardware, using superpages allocated on construction (on the given NUMA node,
+// if any). Without a kernel name, all kernels supported by the CPU are calibrated on construction and the one with
+// the best signal per cycle is used.
+class hardware_timing_source : public timing_source {
+public:
+    explicit hardware_timing_source(size_t num_superpages, std::optional<size_t> numa_node = {}, std::optional<std::string> const& kernel = {});
+
+    [[nodiscard]] uint8_t* get_random_address() const override { return m_memory.get_random_address(); }
+    [[nodiscard]] uintptr_t virt_to_phys(uint8_t* virt) const override { return m_memory.virt_to_phys(virt); }
+    [[nodiscard]] uint8_t* phys_to_virt(uintptr_t phys) const override { return m_memory.phys_to_virt(phys); }
+    [[nodiscard]] std::vector<uintptr_t> phys_superpages() const override { return m_memory.phys_superpages(); }
+
+    void wait_until_ready() override { m_memory.wait_until_populated(); }
+
+    [[nodiscard]] uint64_t time(uint8_t* first, uint8_t* second, size_t iterations, size_t accesses_per_iter) const override;
+    [[nodiscard]] uint64_t time_concurrent(std::vector<uint8_t*> const& addrs, size_t iterations) const override;
+
+    // Names of all kernels, including those the CPU does not support.
+    [[nodiscard]] static std::vector<std::string> kernel_names();
+
+private:
+    [[nodiscard]] timing_kernel const* calibrate() const;
+
+    memory m_memory;
+    timing_kernel const* m_kernel { nullptr };
+};
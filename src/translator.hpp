@@ -0,0 +1,343 @@
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <immintrin.h>
+#include <optional>
+#include <string>
+#include <vector>
+
+#pragma once
+
+// Self-contained (header-only) loader for the mapping descriptors written by dare, and a batch translator from
+// physical addresses to (bank, row, column). Copy this file into other tools to use the mappings found by DARE.
+//
+// Descriptor format (text, one entry per line, '#' starts a comment):
+//   dare-mapping <version>
+//   offset <hex>              physical-to-DRAM offset, subtracted before applying the masks
+//   function <hex> [<label>]  bank function, the i-th function gives bit i of the bank (optional one-word label)
+//   row <hex>                 optional, bits forming the row (compressed, in order)
+//   column <hex>              optional, bits forming the column (compressed, in order)
+
+struct mapping_descriptor {
+    static constexpr unsigned VERSION = 1;
+
+    uint64_t phys_dram_offset { 0 };
+    std::vector<uint64_t> functions;
+    std::vector<std::string> labels;
+    uint64_t row_mask { 0 };
+    uint64_t column_mask { 0 };
+
+    [[nodiscard]] bool save(char const* path) const {
+        FILE* fp = fopen(path, "w");
+        if (!fp) {
+            return false;
+        }
+        fprintf(fp, "dare-mapping %u\n", VERSION);
+        fprintf(fp, "offset 0x%llx\n", (unsigned long long)phys_dram_offset);
+        for (size_t i = 0; i < functions.size(); i++) {
+            fprintf(fp, "function 0x%010llx", (unsigned long long)functions[i]);
+            if (i < labels.size() && !labels[i].empty()) {
+                fprintf(fp, " %s", labels[i].c_str());
+            }
+            fputc('\n', fp);
+        }
+        if (row_mask) {
+            fprintf(fp, "row 0x%010llx\n", (unsigned long long)row_mask);
+        }
+        if (column_mask) {
+            fprintf(fp, "column 0x%010llx\n", (unsigned long long)column_mask);
+        }
+        return fclose(fp) == 0;
+    }
+
+    // Returns nothing if the file cannot be read, is not a mapping descriptor or has an unsupported version.
+    [[nodiscard]] static std::optional<mapping_descriptor> load(char const* path) {
+        FILE* fp = fopen(path, "r");
+        if (!fp) {
+            return {};
+        }
+
+        mapping_descriptor descriptor;
+        bool valid = false;
+        char line[256];
+        for (size_t line_no = 0; fgets(line, sizeof(line), fp); line_no++) {
+            char key[32];
+            char label[64] = "";
+            unsigned long long value;
+            if (line_no == 0) {
+                unsigned version;
+                valid = sscanf(line, "dare-mapping %u", &version) == 1 && version == VERSION;
+                if (!valid) {
+                    break;
+                }
+                continue;
+            }
+            if (line[0] == '#' || sscanf(line, "%31s %llx %63s", key, &value, label) < 2) {
+                continue;
+            }
+            if (strcmp(key, "offset") == 0) {
+                descriptor.phys_dram_offset = value;
+            } else if (strcmp(key, "function") == 0) {
+                descriptor.functions.push_back(value);
+                descriptor.labels.emplace_back(label);
+            } else if (strcmp(key, "row") == 0) {
+                descriptor.row_mask = value;
+            } else if (strcmp(key, "column") == 0) {
+                descriptor.column_mask = value;
+            }
+        }
+        fclose(fp);
+
+        if (!valid) {
+            return {};
+        }
+        return descriptor;
+    }
+};
+
+// Translates physical addresses to (bank, row, column) according to a descriptor. The batch interface uses the fastest
+// kernel the CPU supports at runtime (AVX-512 with VPOPCNTQ, AVX-512 or AVX2), with a scalar fallback.
+class mapping_translator {
+public:
+    // Kernels of the batch interface, from slowest to fastest.
+    enum kernel { KERNEL_SCALAR, KERNEL_AVX2, KERNEL_AVX512, KERNEL_AVX512_VPOPCNTDQ };
+    static constexpr kernel ALL_KERNELS[] = { KERNEL_SCALAR, KERNEL_AVX2, KERNEL_AVX512, KERNEL_AVX512_VPOPCNTDQ };
+
+    explicit mapping_translator(mapping_descriptor const& descriptor)
+        : m_offset(descriptor.phys_dram_offset)
+        , m_functions(descriptor.functions)
+        , m_row_runs(bit_runs(descriptor.row_mask))
+        , m_column_runs(bit_runs(descriptor.column_mask)) {
+        for (auto kernel : ALL_KERNELS) {
+            if (kernel_supported(kernel)) {
+                m_kernel = kernel;
+            }
+        }
+    }
+
+    [[nodiscard]] static bool kernel_supported(kernel kernel) {
+        __builtin_cpu_init();
+        switch (kernel) {
+        case KERNEL_AVX2:
+            return __builtin_cpu_supports("avx2");
+        case KERNEL_AVX512:
+            return __builtin_cpu_supports("avx512f");
+        case KERNEL_AVX512_VPOPCNTDQ:
+            return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512vpopcntdq");
+        default:
+            return true;
+        }
+    }
+
+    [[nodiscard]] static char const* kernel_name(kernel kernel) {
+        switch (kernel) {
+        case KERNEL_AVX2:
+            return "avx2";
+        case KERNEL_AVX512:
+            return "avx512";
+        case KERNEL_AVX512_VPOPCNTDQ:
+            return "avx512-vpopcntdq";
+        default:
+            return "scalar";
+        }
+    }
+
+    [[nodiscard]] kernel current_kernel() const { return m_kernel; }
+
+    // Overrides the kernel picked on construction (e.g., to compare the kernels). Returns false if the CPU does not
+    // support it.
+    bool use_kernel(kernel kernel) {
+        if (!kernel_supported(kernel)) {
+            return false;
+        }
+        m_kernel = kernel;
+        return true;
+    }
+
+    [[nodiscard]] uint64_t bank(uint64_t phys) const {
+        auto dram = phys - m_offset;
+        uint64_t result = 0;
+        for (size_t i = 0; i < m_functions.size(); i++) {
+            result |= uint64_t(__builtin_parityll(m_functions[i] & dram)) << i;
+        }
+        return result;
+    }
+    [[nodiscard]] uint64_t row(uint64_t phys) const { return extract(phys - m_offset, m_row_runs); }
+    [[nodiscard]] uint64_t column(uint64_t phys) const { return extract(phys - m_offset, m_column_runs); }
+
+    // Translates count addresses. Any of the outputs may be null if it is not needed.
+    void translate(uint64_t const* phys, size_t count, uint64_t* banks, uint64_t* rows, uint64_t* columns) const {
+        size_t done = 0;
+        if (m_kernel == KERNEL_AVX512_VPOPCNTDQ) {
+            done = translate_avx512_vpopcntdq(phys, count, banks, rows, columns);
+        } else if (m_kernel == KERNEL_AVX512) {
+            done = translate_avx512(phys, count, banks, rows, columns);
+        } else if (m_kernel == KERNEL_AVX2) {
+            done = translate_avx2(phys, count, banks, rows, columns);
+        }
+        for (size_t i = done; i < count; i++) {
+            if (banks) {
+                banks[i] = bank(phys[i]);
+            }
+            if (rows) {
+                rows[i] = row(phys[i]);
+            }
+            if (columns) {
+                columns[i] = column(phys[i]);
+            }
+        }
+    }
+
+private:
+    // A contiguous run of mask bits: (value >> shift) & mask ends up at bit `position` of the result. This is pext,
+    // but can be vectorized.
+    struct bit_run {
+        uint64_t shift;
+        uint64_t mask;
+        uint64_t position;
+    };
+
+    static std::vector<bit_run> bit_runs(uint64_t mask) {
+        std::vector<bit_run> runs;
+        uint64_t position = 0;
+        while (mask) {
+            auto shift = (uint64_t)__builtin_ctzll(mask);
+            auto length = (uint64_t)__builtin_ctzll(~(mask >> shift));
+            auto run_mask = length == 64 ? ~uint64_t(0) : (uint64_t(1) << length) - 1;
+            runs.push_back({ shift, run_mask, position });
+            position += length;
+            mask &= ~(run_mask << shift);
+        }
+        return runs;
+    }
+
+    static uint64_t extract(uint64_t dram, std::vector<bit_run> const& runs) {
+        uint64_t result = 0;
+        for (auto const& run : runs) {
+            result |= ((dram >> run.shift) & run.mask) << run.position;
+        }
+        return result;
+    }
+
+    __attribute__((target("avx2"))) static __m256i parity_avx2(__m256i v) {
+        v = _mm256_xor_si256(v, _mm256_srli_epi64(v, 32));
+        v = _mm256_xor_si256(v, _mm256_srli_epi64(v, 16));
+        v = _mm256_xor_si256(v, _mm256_srli_epi64(v, 8));
+        v = _mm256_xor_si256(v, _mm256_srli_epi64(v, 4));
+        v = _mm256_xor_si256(v, _mm256_srli_epi64(v, 2));
+        v = _mm256_xor_si256(v, _mm256_srli_epi64(v, 1));
+        return _mm256_and_si256(v, _mm256_set1_epi64x(1));
+    }
+
+    __attribute__((target("avx2"))) static __m256i extract_avx2(__m256i dram, std::vector<bit_run> const& runs) {
+        auto result = _mm256_setzero_si256();
+        for (auto const& run : runs) {
+            auto bits = _mm256_and_si256(_mm256_srl_epi64(dram, _mm_cvtsi64_si128((long long)run.shift)), _mm256_set1_epi64x((long long)run.mask));
+            result = _mm256_or_si256(result, _mm256_sll_epi64(bits, _mm_cvtsi64_si128((long long)run.position)));
+        }
+        return result;
+    }
+
+    __attribute__((target("avx2"))) size_t translate_avx2(uint64_t const* phys, size_t count, uint64_t* banks, uint64_t* rows, uint64_t* columns) const {
+        auto offset = _mm256_set1_epi64x((long long)m_offset);
+        size_t i = 0;
+        for (; i + 4 <= count; i += 4) {
+            auto dram = _mm256_sub_epi64(_mm256_loadu_si256((__m256i const*)(phys + i)), offset);
+            if (banks) {
+                auto result = _mm256_setzero_si256();
+                for (size_t f = 0; f < m_functions.size(); f++) {
+                    auto bit = parity_avx2(_mm256_and_si256(dram, _mm256_set1_epi64x((long long)m_functions[f])));
+                    result = _mm256_or_si256(result, _mm256_sll_epi64(bit, _mm_cvtsi64_si128((long long)f)));
+                }
+                _mm256_storeu_si256((__m256i*)(banks + i), result);
+            }
+            if (rows) {
+                _mm256_storeu_si256((__m256i*)(rows + i), extract_avx2(dram, m_row_runs));
+            }
+            if (columns) {
+                _mm256_storeu_si256((__m256i*)(columns + i), extract_avx2(dram, m_column_runs));
+            }
+        }
+        return i;
+    }
+
+// GCC 12 reports false positives for _mm512_undefined_epi32() used inside the AVX-512 shift intrinsics.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+    __attribute__((target("avx512f"))) static __m512i parity_avx512(__m512i v) {
+        v = _mm512_xor_si512(v, _mm512_srli_epi64(v, 32));
+        v = _mm512_xor_si512(v, _mm512_srli_epi64(v, 16));
+        v = _mm512_xor_si512(v, _mm512_srli_epi64(v, 8));
+        v = _mm512_xor_si512(v, _mm512_srli_epi64(v, 4));
+        v = _mm512_xor_si512(v, _mm512_srli_epi64(v, 2));
+        v = _mm512_xor_si512(v, _mm512_srli_epi64(v, 1));
+        return _mm512_and_si512(v, _mm512_set1_epi64(1));
+    }
+
+    __attribute__((target("avx512f"))) static __m512i extract_avx512(__m512i dram, std::vector<bit_run> const& runs) {
+        auto result = _mm512_setzero_si512();
+        for (auto const& run : runs) {
+            auto bits = _mm512_and_si512(_mm512_srl_epi64(dram, _mm_cvtsi64_si128((long long)run.shift)), _mm512_set1_epi64((long long)run.mask));
+            result = _mm512_or_si512(result, _mm512_sll_epi64(bits, _mm_cvtsi64_si128((long long)run.position)));
+        }
+        return result;
+    }
+
+    __attribute__((target("avx512f"))) size_t translate_avx512(uint64_t const* phys, size_t count, uint64_t* banks, uint64_t* rows, uint64_t* columns) const {
+        auto offset = _mm512_set1_epi64((long long)m_offset);
+        size_t i = 0;
+        for (; i + 8 <= count; i += 8) {
+            auto dram = _mm512_sub_epi64(_mm512_loadu_si512(phys + i), offset);
+            if (banks) {
+                auto result = _mm512_setzero_si512();
+                for (size_t f = 0; f < m_functions.size(); f++) {
+                    auto bit = parity_avx512(_mm512_and_si512(dram, _mm512_set1_epi64((long long)m_functions[f])));
+                    result = _mm512_or_si512(result, _mm512_sll_epi64(bit, _mm_cvtsi64_si128((long long)f)));
+                }
+                _mm512_storeu_si512(banks + i, result);
+            }
+            if (rows) {
+                _mm512_storeu_si512(rows + i, extract_avx512(dram, m_row_runs));
+            }
+            if (columns) {
+                _mm512_storeu_si512(columns + i, extract_avx512(dram, m_column_runs));
+            }
+        }
+        return i;
+    }
+
+    // Like translate_avx512, but the parity is the lowest bit of the population count, which VPOPCNTQ computes in a
+    // single instruction (instead of six shifts and XORs), and the bit of every function is set by a masked OR.
+    __attribute__((target("avx512f,avx512vpopcntdq"))) size_t translate_avx512_vpopcntdq(uint64_t const* phys, size_t count, uint64_t* banks, uint64_t* rows, uint64_t* columns) const {
+        auto offset = _mm512_set1_epi64((long long)m_offset);
+        auto one = _mm512_set1_epi64(1);
+        size_t i = 0;
+        for (; i + 8 <= count; i += 8) {
+            auto dram = _mm512_sub_epi64(_mm512_loadu_si512(phys + i), offset);
+            if (banks) {
+                auto result = _mm512_setzero_si512();
+                for (size_t f = 0; f < m_functions.size(); f++) {
+                    auto ones = _mm512_popcnt_epi64(_mm512_and_si512(dram, _mm512_set1_epi64((long long)m_functions[f])));
+                    auto odd = _mm512_test_epi64_mask(ones, one);
+                    result = _mm512_mask_or_epi64(result, odd, result, _mm512_set1_epi64((long long)(uint64_t(1) << f)));
+                }
+                _mm512_storeu_si512(banks + i, result);
+            }
+            if (rows) {
+                _mm512_storeu_si512(rows + i, extract_avx512(dram, m_row_runs));
+            }
+            if (columns) {
+                _mm512_storeu_si512(columns + i, extract_avx512(dram, m_column_runs));
+            }
+        }
+        return i;
+    }
+#pragma GCC diagnostic pop
+
+    uint64_t m_offset;
+    std::vector<uint64_t> m_functions;
+    std::vector<bit_run> m_row_runs;
+    std::vector<bit_run> m_column_runs;
+    kernel m_kernel { KERNEL_SCALAR };
+};
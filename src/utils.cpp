@@ -1,3 +1,5 @@
 #include "utils.hpp"
 
-bool log_verbose = false;
\ No newline at end of file
+bool log_verbose = false;
+bool log_quiet = false;
+thread_local char log_prefix[32] = "";
\ No newline at end of file
@@ -11,21 +11,27 @@
 
 // Logging
 extern bool log_verbose;
-#define LOG(fstr, ...)                                                  \
-    do {                                                                \
-        fprintf(stdout, TERM_FC_CYAN fstr TERM_F_RESET, ##__VA_ARGS__); \
+// Suppresses everything except errors, for tools that run the analysis many times.
+extern bool log_quiet;
+// Printed before every line logged by the current thread, to tell apart the output of concurrently analyzed nodes.
+extern thread_local char log_prefix[32];
+#define LOG(fstr, ...)                                                                       \
+    do {                                                                                     \
+        if (!log_quiet) {                                                                    \
+            fprintf(stdout, TERM_FC_CYAN "%s" fstr TERM_F_RESET, log_prefix, ##__VA_ARGS__); \
+        }                                                                                    \
     } while (false)
 
-#define LOG_ERROR(fstr, ...)                                           \
-    do {                                                               \
-        fprintf(stdout, TERM_FC_RED fstr TERM_F_RESET, ##__VA_ARGS__); \
+#define LOG_ERROR(fstr, ...)                                                            \
+    do {                                                                                \
+        fprintf(stdout, TERM_FC_RED "%s" fstr TERM_F_RESET, log_prefix, ##__VA_ARGS__); \
     } while (false)
 
-#define LOG_VERBOSE(fstr, ...)                                              \
-    do {                                                                    \
-        if (log_verbose) {                                                  \
-            fprintf(stdout, TERM_FC_GRAY fstr TERM_F_RESET, ##__VA_ARGS__); \
-        }                                                                   \
+#define LOG_VERBOSE(fstr, ...)                                                               \
+    do {                                                                                     \
+        if (log_verbose && !log_quiet) {                                                     \
+            fprintf(stdout, TERM_FC_GRAY "%s" fstr TERM_F_RESET, log_prefix, ##__VA_ARGS__); \
+        }                                                                                    \
     } while (false)
 
 #define BIT(x) (1ULL << size_t(x))